@@ -1,7 +1,11 @@
 #pragma once
 
+#include "config.hpp"
+#include "error.hpp"
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
+#include <span>
 #include <vector>
 
 namespace lzxd {
@@ -9,18 +13,43 @@ namespace lzxd {
 namespace detail {
     template <typename T>
     T byteswap(T input);
+
+    inline uint16_t rotleftu16(uint16_t val, uint8_t bits) {
+        // This is identical to Rust's u16::rotate_left
+        return (val << bits) | (val >> (16 - bits));
+    }
+
+    // The unread bits of a stream in a 64-bit buffer, for decode loops that keep it in registers.
+    // The next bit is the most significant one, `next` is the first word not loaded into it yet.
+    struct BitCursor {
+        const uint8_t* next;
+        uint64_t bits;
+        uint32_t count;
+    };
 } // namespace detail
 
 // A data stream where data is interpreted as 16-bit little-endian integers.
 // See (https://github.com/Lonami/lzxd/blob/master/src/bitstream.rs)
 // and (https://msopenspecs.azureedge.net/files/MS-PATCH/%5bMS-PATCH%5d.pdf) section 3
+// Reads past the end of the data never fail, they return zeros and set the `overflowed` flag,
+// so that callers only need to check it once at a convenient point.
 class BitStream {
 public:
+    // Reads from `data` without copying it, the data must outlive the stream and every copy of it.
+    // This constructor used to copy the data, callers that free or reuse their buffer while the stream
+    // is alive must pass a vector instead.
     BitStream(const uint8_t* data, size_t size);
+    // Takes ownership of `data`, copies of the stream copy it as well
     BitStream(std::vector<uint8_t> data);
 
-    std::vector<uint8_t>& data();
-    const std::vector<uint8_t>& data() const;
+    BitStream(const BitStream& other);
+    BitStream(BitStream&& other) noexcept = default;
+    BitStream& operator=(const BitStream& other);
+    BitStream& operator=(BitStream&& other) noexcept = default;
+
+    // The whole data, which is read-only. This used to return the owned vector, mutable included,
+    // which no longer exists for streams that only view their data.
+    std::span<const uint8_t> data() const;
 
     size_t size() const;
     size_t position() const;
@@ -28,6 +57,9 @@ public:
 
     bool eof() const;
 
+    // Whether a read went past the end of the data
+    bool overflowed() const;
+
     // Reads an integer from the bitstream, advances the buffer position
     template <typename T = uint8_t>
     T readBits() {
@@ -55,7 +87,7 @@ public:
 
     // Reads a number of bits from the bitstream, advances the buffer position
     template <typename T = uint32_t>
-    T readBits(size_t count) {
+    LZXD_HOT_INLINE T readBits(size_t count) {
         auto bits = this->_readBits(count);
         return static_cast<T>(bits);
     }
@@ -84,11 +116,16 @@ public:
 
     // Peeks a number of bits from the bitstream, does not advance the buffer position
     template <typename T = uint8_t>
-    T peekBits(size_t count) {
+    LZXD_HOT_INLINE T peekBits(size_t count) {
         auto bits = this->_peekBits(count);
         return static_cast<T>(bits);
     }
 
+    // The current position as a cursor, and back. A cursor may only be set back on the stream it was
+    // taken from, after reading whole words from it that are all within the data.
+    detail::BitCursor cursor() const;
+    void setCursor(const detail::BitCursor& cursor);
+
     // Skips a certain amount of bits until the bit buffer is aligned to the given boundary, or EOF is reached. The argument is the wanted alignment in bytes.
     void align();
 
@@ -110,10 +147,12 @@ public:
     void peekBytesInto(uint8_t* output, size_t count) const;
 
 private:
-    std::vector<uint8_t> m_data;
+    std::vector<uint8_t> m_storage; // only used by owning streams, `m_data` points into it
+    std::span<const uint8_t> m_data;
     size_t m_position;
     uint16_t m_nextNumber;
     uint8_t m_remainingBits;  // remaining bits in m_nextNumber
+    mutable bool m_overflowed = false;
 
     bool _readBit();
 
@@ -123,10 +162,156 @@ private:
     uint32_t _peekBits(size_t count);
 
     void _oob() const;
-    void _failIfEof() const;
 
     void _advanceBuffer();
     void _advanceBytes(size_t count);
 };
 
-} // namespace lzxd
\ No newline at end of file
+// Hot path, see LZXD_HOT_INLINE
+
+LZXD_HOT_INLINE bool BitStream::eof() const {
+    return m_position >= m_data.size();
+}
+
+LZXD_HOT_INLINE uint8_t BitStream::readByte() {
+    if (this->eof()) {
+        this->_oob();
+        return 0;
+    }
+
+    return m_data[m_position++];
+}
+
+LZXD_HOT_INLINE bool BitStream::_readBit() {
+    if (m_remainingBits == 0) {
+        this->_advanceBuffer();
+    }
+
+    m_remainingBits--;
+    m_nextNumber = detail::rotleftu16(m_nextNumber, 1);
+    return m_nextNumber & 1;
+}
+
+LZXD_HOT_INLINE uint16_t BitStream::_readBitsOneWord(size_t size) {
+    LZXD_DEBUG_ASSERT(size <= 16);
+
+    if (size <= m_remainingBits) {
+        this->m_remainingBits -= size;
+
+        // rotate `m_nextNumber` left by `size` bits
+        m_nextNumber = detail::rotleftu16(m_nextNumber, size);
+
+        return m_nextNumber & ((1 << size) - 1);
+    }
+
+    uint16_t hi = detail::rotleftu16(m_nextNumber, m_remainingBits) & ((1 << m_remainingBits) - 1);
+    size -= m_remainingBits;
+    this->_advanceBuffer();
+
+    m_remainingBits -= size;
+    this->m_nextNumber = detail::rotleftu16(m_nextNumber, size);
+
+    // `bits` may be 16 which would overflow the left shift, operate on `u32` and trunc.
+    uint16_t lo = m_nextNumber & (((uint16_t)(1ul << size)) - 1);
+
+    return (uint16_t)((uint32_t)hi << size) | lo;
+}
+
+LZXD_HOT_INLINE uint32_t BitStream::_readBits(size_t count) {
+    if (count <= 16) {
+        return this->_readBitsOneWord(count);
+    }
+
+    LZXD_DEBUG_ASSERT(count <= 32);
+
+    auto hi = this->_readBitsOneWord(16);
+    auto lo = this->_readBitsOneWord(count - 16);
+
+    return (hi << (count - 16)) | lo;
+}
+
+LZXD_HOT_INLINE uint16_t BitStream::_peekBitsOneWord(size_t count) {
+    LZXD_DEBUG_ASSERT(count <= 16);
+
+    if (count <= m_remainingBits) {
+        return detail::rotleftu16(m_nextNumber, count) & static_cast<uint16_t>((1 << count) - 1);
+    }
+
+    uint16_t hi = detail::rotleftu16(m_nextNumber, m_remainingBits) & ((1 << m_remainingBits) - 1);
+    count -= m_remainingBits;
+
+    // We may peek more than we need (i.e. at the end of a chunk), due to the way
+    // our decoder is implemented. This is a bit ugly but luckily we can pretend
+    // there are just zeros after.
+    uint16_t n;
+    if (this->eof()) {
+        n = 0;
+    } else if (m_data.size() - m_position < sizeof(uint16_t)) {
+        n = m_data[m_position];
+    } else {
+        std::memcpy(&n, m_data.data() + m_position, sizeof(uint16_t));
+#ifdef LZXD_BIG_ENDIAN
+        n = detail::byteswap(n);
+#endif
+    }
+
+    uint16_t lo = detail::rotleftu16(n, count) & (((uint16_t)(1ul << count)) - 1);
+    return (uint16_t)((uint32_t)hi << count) | lo;
+}
+
+LZXD_HOT_INLINE uint32_t BitStream::_peekBits(size_t count) {
+    if (count <= 16) {
+        return this->_peekBitsOneWord(count);
+    }
+
+    LZXD_DEBUG_ASSERT(count <= 32);
+
+    // Store state of the bitstream
+    struct State {
+        uint16_t nextNumber;
+        uint8_t remainingBits;
+        size_t position;
+    } state = {m_nextNumber, m_remainingBits, m_position};
+
+    uint16_t hi = this->_readBitsOneWord(16);
+    uint16_t lo = this->_peekBitsOneWord(count - 16);
+
+    // Restore state of the bitstream
+    m_nextNumber = state.nextNumber;
+    m_remainingBits = state.remainingBits;
+    m_position = state.position;
+
+    return (hi << (count - 16)) | lo;
+}
+
+LZXD_HOT_INLINE void BitStream::_oob() const {
+    m_overflowed = true;
+}
+
+LZXD_HOT_INLINE void BitStream::_advanceBuffer() {
+    this->m_remainingBits = 16;
+
+    if (m_data.size() - m_position < sizeof(uint16_t)) {
+        // A trailing odd byte is the low half of the last word, anything else is past the end
+        if (this->eof()) {
+            this->_oob();
+            m_nextNumber = 0;
+        } else {
+            m_nextNumber = m_data[m_position];
+        }
+
+        m_position = m_data.size();
+        return;
+    }
+
+    std::memcpy(&m_nextNumber, m_data.data() + m_position, sizeof(uint16_t));
+
+    // Since we read a little-endian integer, byteswap if we are on a big-endian architecture
+#ifdef LZXD_BIG_ENDIAN
+    m_nextNumber = detail::byteswap(m_nextNumber);
+#endif
+
+    m_position += sizeof(uint16_t);
+}
+
+} // namespace lzxd
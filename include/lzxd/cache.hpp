@@ -0,0 +1,86 @@
+#pragma once
+
+#include "error.hpp"
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <span>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace lzxd {
+// Decompressed bytes returned by `DiskCache`, either a read-only mapping of a cache entry or,
+// when the entry could not be mapped or written, a buffer of their own.
+class CachedBuffer {
+public:
+    CachedBuffer() = default;
+    CachedBuffer(std::vector<uint8_t> data);
+    CachedBuffer(CachedBuffer&& other) noexcept;
+    CachedBuffer& operator=(CachedBuffer&& other) noexcept;
+    ~CachedBuffer();
+
+    const uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    std::span<const uint8_t> span() const { return {m_data, m_size}; }
+
+    // Whether the bytes are mapped from the cache directory rather than held in memory
+    bool mapped() const { return m_mapping != nullptr; }
+
+private:
+    friend class DiskCache;
+
+    void* m_mapping = nullptr;
+    size_t m_mappingSize = 0;
+    std::vector<uint8_t> m_owned;
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+
+    void release();
+};
+
+// Stores decompressed outputs in a directory, so that a process decoding the same input again can map
+// the result instead. Entries are written to a temporary file and renamed into place, so concurrent
+// writers (including other processes) never expose a partial entry. Once the directory grows past
+// `maxSize`, the least recently used entries are removed, by modification time which hits refresh.
+//
+// Failing to write or read the cache is never an error, it only costs a decode.
+class DiskCache {
+public:
+    static constexpr uint64_t DEFAULT_MAX_SIZE = uint64_t(1) << 30;
+
+    DiskCache(std::filesystem::path directory, uint64_t maxSize = DEFAULT_MAX_SIZE);
+
+    // Key of a compressed input and the parameters it is decoded with, `chunkSize` being the decoded size of its frames
+    static uint64_t key(const uint8_t* data, size_t size, size_t windowSize, size_t outputSize, size_t chunkSize);
+
+    // Maps the entry for `key`, if there is a complete one. Its data is hashed and checked against
+    // the hash stored with it, which reads the whole entry.
+    std::optional<CachedBuffer> find(uint64_t key) const;
+    // Returns whether the entry was written
+    bool store(uint64_t key, const uint8_t* data, size_t size);
+
+    // Returns the entry for `key`, otherwise decodes and stores it. Errors from `decode` are returned as is.
+    Result<CachedBuffer> getOrDecode(uint64_t key, const std::function<Result<std::vector<uint8_t>>()>& decode);
+
+    // Removes the least recently used entries until the cache fits in `maxSize`. Called by `store`
+    // once the entries it knows of exceed it, which excludes those other processes stored meanwhile.
+    void evict();
+
+    // Combined size of every entry
+    uint64_t totalSize() const;
+
+    const std::filesystem::path& directory() const { return m_directory; }
+
+private:
+    std::filesystem::path m_directory;
+    uint64_t m_maxSize;
+    // Size of the directory as of the last scan, plus the entries stored since
+    std::atomic<uint64_t> m_knownSize = 0;
+    std::atomic<bool> m_scanned = false;
+
+    std::filesystem::path entryPath(uint64_t key) const;
+};
+
+} // namespace lzxd
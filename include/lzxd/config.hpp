@@ -0,0 +1,50 @@
+#pragma once
+
+// Byte order of the target
+#if defined __BYTE_ORDER__
+# if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#  define LZXD_LITTLE_ENDIAN
+# elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#  define LZXD_BIG_ENDIAN
+# endif
+#endif
+
+#if defined _MSC_VER
+# define LZXD_LITTLE_ENDIAN // assumption
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+# include <intrin.h>
+# define LZXD_PREFETCH(ptr) _mm_prefetch(reinterpret_cast<const char*>(ptr), _MM_HINT_T0)
+#else
+# define LZXD_PREFETCH(ptr) __builtin_prefetch(ptr)
+#endif
+
+// Bit reads, table lookups and window writes are defined in the headers and force-inlined, so that
+// the decode loop gets them without LTO and each decode kernel gets its own copy compiled for its
+// instruction set rather than calling the baseline one. Defining LZXD_OUTLINE_HOT_PATH (the LZXD_OUTLINE_HOT_PATH CMake option)
+// forces them out of line again, which is only useful to measure what inlining buys.
+#if defined(LZXD_OUTLINE_HOT_PATH)
+# if defined(_MSC_VER) && !defined(__clang__)
+#  define LZXD_HOT_INLINE __declspec(noinline) inline
+# else
+#  define LZXD_HOT_INLINE [[gnu::noinline]] inline
+# endif
+#elif defined(_MSC_VER) && !defined(__clang__)
+# define LZXD_HOT_INLINE __forceinline
+#else
+# define LZXD_HOT_INLINE [[gnu::always_inline]] inline
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+# define LZXD_ALWAYS_INLINE __forceinline
+#else
+# define LZXD_ALWAYS_INLINE [[gnu::always_inline]] inline
+#endif
+
+// Whether decode kernels for newer x86 instruction sets are built and picked at runtime
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__)) && !defined(LZXD_NO_DISPATCH)
+# define LZXD_X86_DISPATCH 1
+#else
+# define LZXD_X86_DISPATCH 0
+#endif
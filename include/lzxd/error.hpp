@@ -1,16 +1,103 @@
 #pragma once
 
+#include <new>
 #include <stdexcept>
+#include <utility>
 
 #define LZXD_ASSERT(cond) if (!(cond)) lzxd::_assertfail(#cond, __FILE__, __LINE__)
 
+// Internal invariants that no input can break, checked in debug builds only. Unlike `LZXD_ASSERT`,
+// these are allowed on the paths of the `noexcept` try* functions.
+#ifdef NDEBUG
+# define LZXD_DEBUG_ASSERT(cond) ((void)0)
+#else
+# define LZXD_DEBUG_ASSERT(cond) LZXD_ASSERT(cond)
+#endif
+
+// Whether the throwing API raises exceptions. When built with -fno-exceptions (or LZXD_NO_EXCEPTIONS),
+// it aborts on error instead and the `try*` functions should be used.
+#if !defined(LZXD_NO_EXCEPTIONS) && (defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND))
+# define LZXD_EXCEPTIONS 1
+#else
+# define LZXD_EXCEPTIONS 0
+#endif
+
 namespace lzxd {
 
+enum class ErrorCode {
+    Ok = 0,
+    InvalidWindowSize,
+    ChunkTooLarge,      // output size larger than the window
+    UnexpectedEof,      // the chunk ended before all of its output was decoded
+    InvalidBlockHeader,
+    InvalidTree,        // path lengths do not form a valid tree
+    InvalidPretreeCode,
+    InvalidMatch,       // a match without a length tree, or crossing the end of its block
+    MatchOutOfBounds,   // a match reaching before the start of the stream or further than the window
+    E8NotImplemented,
+    InvalidChunkTable,  // chunk offsets that do not match the output size or are out of order
+    OutputTooSmall,     // output segments that cannot hold the chunk
+    OutOfMemory,
+    Unknown,
+};
+
+const char* errorMessage(ErrorCode code);
+
 class LzxdError : public std::runtime_error {
 public:
-    LzxdError(const std::string& message) : std::runtime_error(message) {}
+    LzxdError(const std::string& message) : std::runtime_error(message), m_code(ErrorCode::Unknown) {}
+    LzxdError(ErrorCode code) : std::runtime_error(errorMessage(code)), m_code(code) {}
+
+    ErrorCode code() const { return m_code; }
+
+private:
+    ErrorCode m_code;
+};
+
+// Either a value or an error code, for the exception-free API
+template <typename T>
+class Result {
+public:
+    Result(T value) : m_value(std::move(value)), m_error(ErrorCode::Ok) {}
+    Result(ErrorCode error) : m_value(), m_error(error) {}
+
+    bool ok() const { return m_error == ErrorCode::Ok; }
+    explicit operator bool() const { return this->ok(); }
+
+    ErrorCode error() const { return m_error; }
+
+    // Only meaningful if `ok()`
+    T& value() { return m_value; }
+    const T& value() const { return m_value; }
+
+private:
+    T m_value;
+    ErrorCode m_error;
 };
 
 [[noreturn]] void _assertfail(const char* message, const char* file, int line);
 
-}
\ No newline at end of file
+// Throws an `LzxdError`, or aborts if exceptions are disabled
+[[noreturn]] void _raise(ErrorCode code);
+
+namespace detail {
+    // Reserves room in a vector, returning false instead of throwing when out of memory, for the
+    // `noexcept` paths. Without exceptions, running out of memory aborts like everywhere else.
+    template <typename Vector>
+    bool tryReserve(Vector& vector, size_t size) noexcept {
+#if LZXD_EXCEPTIONS
+        try {
+            vector.reserve(size);
+        } catch (const std::bad_alloc&) {
+            return false;
+        } catch (const std::length_error&) {
+            return false;
+        }
+#else
+        vector.reserve(size);
+#endif
+        return true;
+    }
+} // namespace detail
+
+}
@@ -3,7 +3,14 @@
 #include "block.hpp"
 #include "tree.hpp"
 #include "window.hpp"
+#include "error.hpp"
+#include "profile.hpp"
+#include <algorithm>
+#include <memory>
 #include <optional>
+#include <memory_resource>
+#include <span>
+#include <vector>
 
 namespace lzxd {
 namespace detail {
@@ -15,24 +22,222 @@ namespace detail {
         int32_t translationSize;
     };
 
+    // Returns 0 if the window size is invalid
     size_t positionSlotsFor(size_t windowSize);
+
+    // Smallest block for which the main tree gets a multi-literal table
+    constexpr size_t MULTI_LITERAL_MIN_BLOCK_SIZE = 8192;
+
+    // In windows of at least `PREFETCH_MIN_WINDOW_SIZE`, matches at least `PREFETCH_MIN_OFFSET` back
+    // are prefetched and executed one token later. Smaller windows mostly stay in cache.
+    constexpr size_t PREFETCH_MIN_WINDOW_SIZE = 0x400000;
+    constexpr size_t PREFETCH_MIN_OFFSET = 0x40000;
+
+    // Longest match, a length footer of 248 past the 7 + 2 of the main element
+    constexpr size_t MAX_MATCH_LENGTH = 257;
+
+    // A chunk recorded as literals and matches instead of written to the window, so that
+    // `decompressFramedParallel` can build its output on another thread
+    struct ChunkTokens {
+        struct Sequence {
+            uint32_t literals; // taken from `literals` before the match
+            uint32_t offset;
+            uint32_t length;
+        };
+
+        std::vector<uint8_t> literals; // including the contents of uncompressed blocks
+        std::vector<Sequence> sequences;
+        uint32_t trailingLiterals = 0; // after the last match
+
+        void clear() {
+            literals.clear();
+            sequences.clear();
+            trailingLiterals = 0;
+        }
+
+        // The buffers grow with what the chunks hold and are kept across them. These return false
+        // when out of memory.
+        bool pushLiteral(uint8_t value) noexcept {
+            if (!grow(literals, 1)) {
+                return false;
+            }
+
+            literals.push_back(value);
+            trailingLiterals++;
+            return true;
+        }
+
+        bool pushMatch(uint32_t offset, uint32_t length) noexcept {
+            if (!grow(sequences, 1)) {
+                return false;
+            }
+
+            sequences.push_back({trailingLiterals, offset, length});
+            trailingLiterals = 0;
+            return true;
+        }
+
+        // Returns room for `count` more literals, or null
+        uint8_t* appendLiterals(size_t count) noexcept {
+            if (!grow(literals, count)) {
+                return nullptr;
+            }
+
+            literals.resize(literals.size() + count);
+            trailingLiterals += static_cast<uint32_t>(count);
+            return literals.data() + literals.size() - count;
+        }
+
+    private:
+        template <typename Vector>
+        static bool grow(Vector& vector, size_t count) noexcept {
+            if (vector.capacity() - vector.size() >= count) [[likely]] {
+                return true;
+            }
+
+            return tryReserve(vector, std::max({vector.size() + count, vector.capacity() * 2, size_t(4096)}));
+        }
+    };
+
+    class FramedPipeline;
+    struct InterleavedLane;
 } // namespace detail
 
+// Uncompressed size of an LZX frame. Larger chunks, up to the window size, are supported as long
+// as the encoder produced frames of the same size.
+constexpr size_t DEFAULT_CHUNK_SIZE = 32768;
+// Window of a default constructed `Decoder`
+constexpr size_t DEFAULT_WINDOW_SIZE = 0x80000;
+
+class Decoder;
+class TreeCache;
+
+// Builds of the decode loop for different instruction sets, see `Decoder::setKernel`
+enum class DecodeKernel {
+    Scalar, // portable
+    Avx2,   // x86 with AVX2 and BMI2
+};
+
+// A destination for part of a chunk, see `Decoder::decompressChunkScatter`
+struct OutputSegment {
+    void* base;
+    size_t length;
+};
+
+// A chunk to decode with `Decoder::decompressInterleaved`
+struct InterleavedChunk {
+    Decoder* decoder;
+    const uint8_t* data;
+    size_t size;
+    uint8_t* output;
+    size_t outputSize = DEFAULT_CHUNK_SIZE;
+    size_t decodedLen = 0; // set once decoded
+    ErrorCode error = ErrorCode::Ok;
+};
+
 class Decoder {
 public:
-    Decoder(size_t windowSize);
+    // All internal buffers, including the window, are allocated from `resource`.
+    // See `hugePageResource` for backing large windows with huge pages.
+    // Raises `ErrorCode::InvalidWindowSize` unless the window size is a power of two from 32 KiB to 32 MiB.
+    Decoder(size_t windowSize, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
     Decoder();
+    // Copies allocate from the memory resource of `other` unless given one, see `clone`
+    Decoder(const Decoder& other);
+    Decoder(const Decoder& other, std::pmr::memory_resource* resource);
+    Decoder(Decoder&&) = default;
+    // Assignment keeps the memory resource of the target, like `std::pmr` containers. Moving from a
+    // decoder with another resource copies it.
+    Decoder& operator=(const Decoder& other);
+    Decoder& operator=(Decoder&& other);
+
+    std::vector<uint8_t> decompressChunk(const std::vector<uint8_t>& data, size_t outputSize = DEFAULT_CHUNK_SIZE);
+    std::vector<uint8_t> decompressChunk(const uint8_t* data, size_t size, size_t outputSize = DEFAULT_CHUNK_SIZE);
+
+    size_t decompressChunkInto(const std::vector<uint8_t>& data, uint8_t* output, size_t outputSize = DEFAULT_CHUNK_SIZE);
+    size_t decompressChunkInto(const uint8_t* data, size_t size, uint8_t* output, size_t outputSize = DEFAULT_CHUNK_SIZE);
+
+    // Decodes a chunk into `segments`, filling them in order. Raises `ErrorCode::OutputTooSmall`
+    // before decoding anything if they cannot hold `outputSize` bytes.
+    size_t decompressChunkScatter(const std::vector<uint8_t>& data, std::span<const OutputSegment> segments, size_t outputSize = DEFAULT_CHUNK_SIZE);
+    size_t decompressChunkScatter(const uint8_t* data, size_t size, std::span<const OutputSegment> segments, size_t outputSize = DEFAULT_CHUNK_SIZE);
+
+    // Decodes a chunk and returns its bytes in place, usually straight from the window, saving the copy
+    // into an output buffer. The view is only valid until the next call that decodes or resets.
+    std::span<const uint8_t> decompressChunkView(const std::vector<uint8_t>& data, size_t outputSize = DEFAULT_CHUNK_SIZE);
+    std::span<const uint8_t> decompressChunkView(const uint8_t* data, size_t size, size_t outputSize = DEFAULT_CHUNK_SIZE);
+
+    // Decodes a chunk without producing any output, checking that every match stays within the data
+    // decoded so far. Raises on corrupt input, otherwise returns the decoded size of the chunk.
+    // The decoder advances as with `decompressChunkInto`, so a whole stream can be validated chunk by chunk.
+    size_t validateChunk(const std::vector<uint8_t>& data, size_t outputSize = DEFAULT_CHUNK_SIZE);
+    size_t validateChunk(const uint8_t* data, size_t size, size_t outputSize = DEFAULT_CHUNK_SIZE);
+
+    // Advances the decoder past a whole chunk, only filling the window for later chunks. Returns the
+    // decoded size of the chunk. Every token still has to be decoded, so this costs about as much as
+    // `decompressChunkInto` minus the copy of the output. Skipping works in whole chunks, to start
+    // from an offset within one, decode it with `decompressChunkView` and drop the bytes before it.
+    size_t skipChunk(const std::vector<uint8_t>& data, size_t outputSize = DEFAULT_CHUNK_SIZE);
+    size_t skipChunk(const uint8_t* data, size_t size, size_t outputSize = DEFAULT_CHUNK_SIZE);
+
+    // Exception-free versions of the functions above, which never throw or abort on corrupt input.
+    // The few allocations they may make report `ErrorCode::OutOfMemory` when they fail.
+    // After an error the decoder state is undefined and it must be `reset()` before decoding a new stream.
+    Result<size_t> tryDecompressChunkInto(const uint8_t* data, size_t size, uint8_t* output, size_t outputSize = DEFAULT_CHUNK_SIZE) noexcept;
+    Result<size_t> tryDecompressChunkScatter(const uint8_t* data, size_t size, std::span<const OutputSegment> segments, size_t outputSize = DEFAULT_CHUNK_SIZE) noexcept;
+    Result<std::span<const uint8_t>> tryDecompressChunkView(const uint8_t* data, size_t size, size_t outputSize = DEFAULT_CHUNK_SIZE) noexcept;
+    Result<size_t> tryValidateChunk(const uint8_t* data, size_t size, size_t outputSize = DEFAULT_CHUNK_SIZE) noexcept;
+    Result<size_t> trySkipChunk(const uint8_t* data, size_t size, size_t outputSize = DEFAULT_CHUNK_SIZE) noexcept;
+
+    // Decodes one chunk for each of the given decoders, which must all be distinct, interleaving their
+    // decode loops on the current thread. Each decoder advances exactly as with `decompressChunkInto`.
+    // Never throws, failures are reported in `InterleavedChunk::error`.
+    static void decompressInterleaved(std::span<InterleavedChunk> chunks);
+
+    // The decode loop in use. Defaults to the fastest one supported by the CPU, picked at construction.
+    DecodeKernel kernel() const;
+    // Returns false and keeps the current kernel if the CPU or the build does not support `kernel`
+    bool setKernel(DecodeKernel kernel);
+    static bool kernelSupported(DecodeKernel kernel);
 
-    std::vector<uint8_t> decompressChunk(const std::vector<uint8_t>& data, size_t outputSize = 32768);
-    std::vector<uint8_t> decompressChunk(const uint8_t* data, size_t size, size_t outputSize = 32768);
+    // Takes the main and length trees from `cache` instead of building them, null to stop.
+    // Decoding allocates when the cache misses.
+    void setTreeCache(std::shared_ptr<TreeCache> cache);
 
-    size_t decompressChunkInto(const std::vector<uint8_t>& data, uint8_t* output, size_t outputSize = 32768);
-    size_t decompressChunkInto(const uint8_t* data, size_t size, uint8_t* output, size_t outputSize = 32768);
+#if defined(LZXD_ENABLE_PROFILING)
+    // Cycles spent in each phase, over all chunks since the last `resetProfile`. Kept across `reset()`.
+    const Profile& profile() const;
+    void resetProfile();
+#endif
 
+    // Returns a copy of the decoder, which continues the same stream independently. Where supported (Linux),
+    // the window is shared copy-on-write: the first clone after decoding writes the window to a memfd once,
+    // then clones map it privately and only duplicate the pages they write to.
+    // The window of a clone is made of 4 KiB pages, regardless of the memory resource.
+    Decoder clone();
+
+    // Prepares the decoder for a new stream. This is cheap, no buffers are reallocated, so a single
+    // decoder can be reused for formats that compress every chunk independently.
     void reset();
 
 private:
+    struct ChunkState {
+        BitStream stream;
+        size_t outputSize;
+        uint8_t* output = nullptr; // null when validating or skipping, or with another kind of output below
+
+        ChunkState(BitStream stream, size_t outputSize) : stream(std::move(stream)), outputSize(outputSize) {}
+
+        size_t decodedLen = 0;
+        std::optional<detail::DecodedMatch> pendingMatch;
+        bool view = false; // output is read from the window instead of copied
+        std::span<const OutputSegment> segments; // output is scattered into these instead of a single buffer
+        detail::ChunkTokens* tokens = nullptr; // output is recorded into this instead of the window
+    };
+
     size_t windowSize;
+    std::pmr::memory_resource* resource;
+    size_t prefetchMinOffset;
     size_t decodedChunks = 0;
     detail::Window window;
     CanonicalTree mainTree;
@@ -43,10 +248,57 @@ private:
 
     std::optional<detail::E8Translator> e8Translator;
 
+    using DecodeLoop = ErrorCode (Decoder::*)(ChunkState&);
+    DecodeKernel activeKernel = DecodeKernel::Scalar;
+    DecodeLoop decodeLoop;
+
+    // Decoding tables of the current block, rebuilt in place
+    Tree mainTreeInstance;
+    Tree lengthTreeInstance;
+    Tree alignedOffsetTree;
+    Tree pretree;
+
+    // Set instead of the instances above while a tree cache is in use
+    std::shared_ptr<TreeCache> treeCache;
+    std::shared_ptr<const Tree> sharedMainTree;
+    std::shared_ptr<const Tree> sharedLengthTree;
+
+#if defined(LZXD_ENABLE_PROFILING)
+    detail::Profiler profiler;
+#endif
+
+    void reserveTrees();
     void firstChunk(BitStream& stream);
 
-    Block readBlock(BitStream& stream, const BlockHeader& header);
-    void readMainAndLengthTrees(BitStream& stream);
+    Result<size_t> decodeChunk(ChunkState& state);
+    ErrorCode beginChunk(ChunkState& state);
+    // With `Record`, tokens are appended to `state.tokens` and the window is left untouched
+    template <bool Record = false>
+    ErrorCode decodeStep(ChunkState& state);
+    // Runs `decodeStep` until the chunk is decoded, instantiated once per kernel
+    template <bool Record = false>
+    ErrorCode decodeSteps(ChunkState& state);
+    ErrorCode decodeLoopScalar(ChunkState& state);
+    ErrorCode decodeLoopAvx2(ChunkState& state);
+    // Same as the above for `decompressInterleaved`, see `detail::InterleavedLane`
+    static void interleaveSteps(InterleavedChunk* chunks, std::optional<ChunkState>* states, size_t count);
+    static void interleaveLoopScalar(InterleavedChunk* chunks, std::optional<ChunkState>* states, size_t count);
+    static void interleaveLoopAvx2(InterleavedChunk* chunks, std::optional<ChunkState>* states, size_t count);
+    void flushPendingMatch(ChunkState& state);
+    Result<size_t> finishChunk(ChunkState& state);
+    // Copies the last `len` bytes of the window into `segments`, in order
+    void scatterOutput(std::span<const OutputSegment> segments, size_t len);
+
+    // Decodes a chunk into `tokens`. Matches reaching before the start of the stream fail with
+    // `ErrorCode::MatchOutOfBounds`, as they cannot be resolved from the output.
+    Result<size_t> recordChunk(const uint8_t* data, size_t size, size_t outputSize, detail::ChunkTokens& tokens) noexcept;
+    friend class detail::FramedPipeline;
+    friend struct detail::InterleavedLane;
+
+    ErrorCode readBlock(BitStream& stream, const BlockHeader& header, Block& out);
+    // Builds `instance`, or takes the tree from the cache into `shared`. Returns null if the lengths are invalid.
+    const Tree* buildTree(const CanonicalTree& tree, Tree& instance, std::shared_ptr<const Tree>& shared, bool multiLiterals);
+    ErrorCode readMainAndLengthTrees(BitStream& stream);
 };
 
 } // namespace lzxd
\ No newline at end of file
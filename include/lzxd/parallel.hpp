@@ -0,0 +1,58 @@
+#pragma once
+
+#include "lzxd.hpp"
+#include <span>
+
+namespace lzxd {
+
+// A resource made of chunks that were each compressed as a stream of their own, as in WIM files.
+// Chunk `i` is stored at `data[offsets[i], offsets[i + 1])` and decodes to `chunkSize` bytes,
+// except for the last one which holds the remainder of `outputSize`.
+struct IndependentChunks {
+    const uint8_t* data;
+    std::span<const size_t> offsets; // one more entry than there are chunks, the last one is the end of the data
+    size_t outputSize;
+    size_t chunkSize = DEFAULT_CHUNK_SIZE;
+    size_t windowSize = DEFAULT_WINDOW_SIZE;
+    std::shared_ptr<TreeCache> treeCache = nullptr; // shared by the decoders of every thread if set
+};
+
+// Decodes every chunk into `output`, which must hold `outputSize` bytes, using up to `threads`
+// threads (0 for one per core). Each thread reuses a single decoder, resetting it between chunks.
+// Returns the error of a failed chunk, in which case the contents of `output` are unspecified.
+ErrorCode decompressChunksParallel(
+    const IndependentChunks& chunks,
+    uint8_t* output,
+    unsigned threads = 0,
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+);
+
+// A single stream split in frames whose compressed sizes are known up front, as in `.gmsodf` databases.
+// Chunk `i` is stored at `data[offsets[i], offsets[i + 1])` and decodes to `chunkSize` bytes, except
+// for the last one which holds the remainder of `outputSize`. Unlike `IndependentChunks`, every chunk
+// depends on the ones before it.
+struct FramedChunks {
+    const uint8_t* data;
+    std::span<const size_t> offsets; // one more entry than there are chunks, the last one is the end of the data
+    size_t outputSize;
+    size_t chunkSize = DEFAULT_CHUNK_SIZE;
+    size_t windowSize = DEFAULT_WINDOW_SIZE;
+};
+
+// Decodes the whole stream into `output`, which must hold `outputSize` bytes, using up to `threads`
+// threads (0 for one per core), and never more than 4.
+//
+// The calling thread decodes the Huffman codes of each chunk in order, which cannot be parallelized
+// since trees are sent as deltas of the previous ones. It only records literals and matches, and the
+// other threads build the output from them. Bytes copied from earlier chunks are left as references
+// into the output and resolved in order once those chunks are complete. At most 8 recorded chunks
+// are held at a time. Decoding stops at the first corrupt chunk and returns its error, the output
+// is then incomplete.
+ErrorCode decompressFramedParallel(
+    const FramedChunks& chunks,
+    uint8_t* output,
+    unsigned threads = 0,
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+);
+
+} // namespace lzxd
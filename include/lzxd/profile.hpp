@@ -0,0 +1,127 @@
+#pragma once
+
+#include "block.hpp"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+# include <intrin.h>
+#endif
+
+// Opt-in instrumentation of the decode loop, enabled by defining LZXD_ENABLE_PROFILING (the LZXD_PROFILING
+// CMake option). It attributes cycles to the phases of every chunk and block, and emits SDT probes
+// (provider `lzxd`) that `perf` and `bpftrace` can attach to. When disabled, none of it is compiled in.
+
+#if defined(LZXD_ENABLE_PROFILING)
+# define LZXD_PROFILE(...) __VA_ARGS__
+# if defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#   include <sys/sdt.h>
+#   define LZXD_PROBE(name, ...) STAP_PROBEV(lzxd, name, __VA_ARGS__)
+#  endif
+# endif
+#else
+# define LZXD_PROFILE(...)
+#endif
+
+#ifndef LZXD_PROBE
+# define LZXD_PROBE(name, ...)
+#endif
+
+// Attributes the time until the end of the enclosing scope to `phase`
+#define LZXD_PROFILE_PHASE(profiler, phase) LZXD_PROFILE(lzxd::detail::ScopedPhase _lzxdScopedPhase{profiler, phase})
+
+namespace lzxd {
+
+enum class Phase {
+    Trees,        // reading block headers and building trees
+    Tokens,       // decoding literals and matches, everything not covered by other phases
+    Matches,      // copying matches within the window
+    Uncompressed, // copying uncompressed blocks into the window
+    Output,       // copying the chunk out of the window
+    Count,
+};
+
+constexpr size_t PHASE_COUNT = static_cast<size_t>(Phase::Count);
+
+const char* phaseName(Phase phase);
+
+// Cycles spent in each phase, indexed by `Phase`. On x86 these are TSC ticks, nanoseconds elsewhere.
+using PhaseCycles = std::array<uint64_t, PHASE_COUNT>;
+
+// The part of a block decoded within one chunk
+struct BlockProfile {
+    BlockType type;
+    uint32_t size;
+    PhaseCycles cycles{};
+};
+
+struct ChunkProfile {
+    size_t index = 0;       // number of the chunk in the stream
+    size_t size = 0;        // decoded size
+    uint64_t totalCycles = 0;
+    PhaseCycles cycles{};
+    std::vector<BlockProfile> blocks;
+};
+
+// Statistics over every chunk decoded since the last `reset`
+struct Profile {
+    size_t chunks = 0;
+    PhaseCycles cycles{};
+    // Chunks counted by total cycles, bucket `i` holds chunks that took [2^i, 2^(i+1)) cycles
+    std::array<uint64_t, 64> latencyHistogram{};
+    ChunkProfile lastChunk;
+
+    void reset();
+};
+
+namespace detail {
+    // Inline, so that timing a phase costs little more than the reads themselves
+    inline uint64_t readCycles() {
+#if defined(_MSC_VER) && !defined(__clang__) && (defined(_M_X64) || defined(_M_IX86))
+        return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+        return __builtin_ia32_rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    class Profiler {
+    public:
+        Profile profile;
+
+        // Room for the blocks of a chunk, so that profiling does not allocate in the common case
+        Profiler() { profile.lastChunk.blocks.reserve(16); }
+
+        void beginChunk(size_t index, size_t compressedSize);
+        // Starts the segment of a block within the current chunk
+        void beginBlock(BlockType type, uint32_t size);
+        // Ends the current block segment, called once the chunk is decoded and before its output is copied
+        void endBlock();
+        void add(Phase phase, uint64_t cycles);
+        void endChunk(size_t size);
+
+    private:
+        uint64_t m_chunkStart = 0;
+        uint64_t m_blockStart = 0;
+        bool m_inBlock = false;
+
+        void endBlock(uint64_t now);
+    };
+
+    struct ScopedPhase {
+        Profiler& profiler;
+        Phase phase;
+        uint64_t start = readCycles();
+
+        ~ScopedPhase() {
+            profiler.add(phase, readCycles() - start);
+        }
+    };
+} // namespace detail
+
+} // namespace lzxd
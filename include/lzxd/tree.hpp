@@ -1,36 +1,130 @@
 #pragma once
 
 #include "bitstream.hpp"
+#include "error.hpp"
 #include <vector>
 #include <cstdint>
 #include <cstddef>
 #include <optional>
 #include <algorithm>
+#include <array>
+#include <memory_resource>
 
 namespace lzxd {
 
 class CanonicalTree;
 
+// Up to three consecutive literals resolved by a single lookup into `Tree::m_multiLiterals`
+struct MultiLiteral {
+    uint8_t count; // 0 or 1 when the lookup is not worth it
+    uint8_t bits;  // total length of the codes
+    uint8_t literals[3];
+};
+
+// Codes up to `TABLE_BITS` long are resolved by a single table lookup, longer ones take a slower
+// canonical decode. This bounds the cost of building a tree, which would otherwise fill up to 2^16
+// entries for every block, however small.
 class Tree {
 public:
-    std::vector<uint8_t> m_lengths;
-    std::vector<uint16_t> m_huffmanCodes;
-    uint8_t m_largestLength;
+    // Amount of bits peeked for a multi-literal lookup
+    static constexpr uint8_t MULTI_LITERAL_BITS = 12;
+    // Amount of bits resolved by `m_huffmanCodes`
+    static constexpr uint8_t TABLE_BITS = 12;
+    // Table entry for the prefix of a code longer than `TABLE_BITS`
+    static constexpr uint16_t LONG_CODE = 0xFFFF;
+
+    std::pmr::vector<uint8_t> m_lengths;
+    std::pmr::vector<uint16_t> m_huffmanCodes;
+    std::pmr::vector<MultiLiteral> m_multiLiterals; // empty unless built by `buildMultiLiterals`
+    uint8_t m_largestLength = 0;
+    uint8_t m_tableBits = 0; // min(m_largestLength, TABLE_BITS)
+
+    // Symbols ordered by code, and where the codes of each length start, for codes longer than `m_tableBits`
+    std::pmr::vector<uint16_t> m_sortedSymbols;
+    std::array<uint32_t, 17> m_firstCode{};
+    std::array<uint16_t, 17> m_lengthCounts{};
+    std::array<uint16_t, 17> m_symbolOffsets{};
 
-    static Tree fromPathLengths(std::vector<uint8_t> lengths);
+    Tree(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : m_lengths(resource), m_huffmanCodes(resource), m_multiLiterals(resource), m_sortedSymbols(resource) {}
+    // Copies `other`, allocating from `resource`. Assigning keeps the memory resource of the target.
+    Tree(const Tree& other, std::pmr::memory_resource* resource) : Tree(resource) { *this = other; }
+    Tree(const Tree&) = default;
+    Tree(Tree&&) = default;
+    Tree& operator=(const Tree&) = default;
+    Tree& operator=(Tree&&) = default;
+
+    // The lengths must form a valid tree, use `CanonicalTree::createInstance` for untrusted input
+    static Tree fromPathLengths(std::pmr::vector<uint8_t> lengths);
+
+    // Allocates room for `symbols` lengths of up to `maxLength` bits, so that rebuilding the tree never allocates
+    void reserve(size_t symbols, uint8_t maxLength, bool multiLiterals);
+
+    // Rebuilds the decoding table from `m_lengths`, reusing the buffers. Returns false if the lengths
+    // do not form a valid tree. Any multi-literal table is discarded.
+    bool build();
 
     uint16_t decodeElement(BitStream& stream) const;
+    uint16_t decodeLongElement(BitStream& stream) const;
+
+    // Builds the multi-literal table if the code lengths make it profitable, that is
+    // when short literal codes are likely enough to often appear back to back.
+    // Only meaningful for the main tree, where symbols 0-255 are literals.
+    void buildMultiLiterals();
+
+    // Decodes several literals at once if the next codes are all literals and at most `max` of them.
+    // Returns the amount of literals written to `out`, or 0 if the caller should use `decodeElement` instead.
+    size_t decodeLiterals(BitStream& stream, uint8_t* out, size_t max) const;
 };
 
 class CanonicalTree {
 public:
-    std::vector<uint8_t> m_lengths;
+    std::pmr::vector<uint8_t> m_lengths;
 
-    CanonicalTree(std::vector<uint8_t> lengths) : m_lengths(std::move(lengths)) {}
+    CanonicalTree(std::pmr::vector<uint8_t> lengths) : m_lengths(std::move(lengths)) {}
+    // Copies `other`, allocating from `resource`
+    CanonicalTree(const CanonicalTree& other, std::pmr::memory_resource* resource) : m_lengths(other.m_lengths, resource) {}
+    CanonicalTree(const CanonicalTree&) = default;
+    CanonicalTree(CanonicalTree&&) = default;
+    CanonicalTree& operator=(const CanonicalTree&) = default;
+    CanonicalTree& operator=(CanonicalTree&&) = default;
 
+    // The instance allocates from the same memory resource as this tree
     std::optional<Tree> createInstance() const;
-    void updateRangeWithPretree(BitStream& stream, size_t start, size_t end);
+    // Same as `createInstance`, but reuses the buffers of `out`
+    bool buildInstance(Tree& out) const;
+
+    // `pretree` is scratch space for the pretree, reserved for 20 symbols of up to 15 bits to avoid allocating
+    ErrorCode updateRangeWithPretree(BitStream& stream, size_t start, size_t end, Tree& pretree);
+    ErrorCode updateRangeWithPretree(BitStream& stream, size_t start, size_t end);
 };
 
+LZXD_HOT_INLINE uint16_t Tree::decodeElement(BitStream& stream) const {
+    // Perform the inverse translation, peeking as many bits as our table is…
+    uint32_t idx = stream.peekBits<uint32_t>(this->m_tableBits);
+    auto code = this->m_huffmanCodes[idx];
+
+    if (code == LONG_CODE) [[unlikely]] {
+        return this->decodeLongElement(stream);
+    }
+
+    // …and then advancing the stream by the length of the code
+    stream.readBits(this->m_lengths[code]);
+
+    return code;
+}
+
+LZXD_HOT_INLINE size_t Tree::decodeLiterals(BitStream& stream, uint8_t* out, size_t max) const {
+    auto idx = stream.peekBits<uint32_t>(MULTI_LITERAL_BITS);
+    const auto& entry = m_multiLiterals[idx];
+
+    if (entry.count < 2 || entry.count > max) {
+        return 0;
+    }
+
+    stream.readBits(entry.bits);
+    std::copy(entry.literals, entry.literals + entry.count, out);
+    return entry.count;
+}
 
-} // namespace lzxd
\ No newline at end of file
+} // namespace lzxd
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "tree.hpp"
+#include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+namespace lzxd {
+
+struct TreeCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t savedNs = 0; // time it took to build the tables handed out on hits
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+// Decoding tables shared between decoders, keyed by their path lengths, so that streams produced
+// with the same encoder settings build each tree once per process. See `Decoder::setTreeCache`.
+//
+// Trees handed out are immutable and stay valid for as long as they are held, even once evicted.
+// Safe to use from several threads, as long as `resource` is.
+class TreeCache {
+public:
+    static constexpr size_t DEFAULT_MAX_BYTES = size_t(16) << 20;
+
+    TreeCache(size_t maxBytes = DEFAULT_MAX_BYTES, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    // Returns the tree for `lengths`, building it on a miss, or null if the lengths do not form a valid tree.
+    // With `multiLiterals`, the tree is built with `Tree::buildMultiLiterals`.
+    std::shared_ptr<const Tree> get(std::span<const uint8_t> lengths, bool multiLiterals);
+
+    TreeCacheStats stats() const;
+    void clear();
+
+private:
+    struct Entry {
+        uint64_t key;
+        std::shared_ptr<const Tree> tree;
+        uint64_t buildNs;
+        size_t bytes;
+    };
+
+    size_t m_maxBytes;
+    std::pmr::memory_resource* m_resource;
+
+    mutable std::mutex m_mutex;
+    std::list<Entry> m_entries; // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+    TreeCacheStats m_stats;
+
+    void evict();
+};
+
+} // namespace lzxd
@@ -1,23 +1,167 @@
 #pragma once
 
 #include "bitstream.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <cstring>
+#include <memory>
 #include <vector>
+#include <memory_resource>
 #include <cstddef>
 #include <cstdint>
 
 namespace lzxd::detail {
 
+// Contents of a window written to a memfd, which its copies map privately
+struct WindowSnapshot;
+
+// Storage of the window, allocated from a memory resource, or a private mapping of a snapshot once
+// `snapshot` was called on the buffer it was copied from. Mapped buffers only duplicate the pages
+// they write to. Copies are deep otherwise.
+class WindowBuffer {
+public:
+    WindowBuffer(size_t size, std::pmr::memory_resource* resource);
+    WindowBuffer(const WindowBuffer& other);
+    // Copies `other`, allocating from `resource` unless the snapshot is mapped
+    WindowBuffer(const WindowBuffer& other, std::pmr::memory_resource* resource);
+    WindowBuffer(WindowBuffer&& other) noexcept;
+    WindowBuffer& operator=(WindowBuffer other) noexcept;
+    ~WindowBuffer();
+
+    uint8_t* data() { return m_data; }
+    const uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    uint8_t& operator[](size_t idx) { return m_data[idx]; }
+    const uint8_t& operator[](size_t idx) const { return m_data[idx]; }
+
+    // Writes the contents to a snapshot for copies to share, unless the current one is still valid.
+    // Returns false if the platform or the system does not allow it.
+    bool snapshot();
+    // Must be called before modifying the contents, which invalidates the snapshot
+    void beginWrite() { m_snapshot.reset(); }
+    // Whether the storage is a mapping of a snapshot, shared with other buffers until written to
+    bool mapped() const { return m_mapping != nullptr; }
+
+private:
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    std::pmr::memory_resource* m_resource;
+    void* m_mapping = nullptr;
+    std::shared_ptr<WindowSnapshot> m_snapshot;
+
+    void release();
+};
+
 struct Window {
-    std::vector<uint8_t> data;
+    WindowBuffer data;
     size_t position;
+    // Holds the result of `pastView` when the range wraps around
+    std::pmr::vector<uint8_t> scratch;
 
     void push(uint8_t byte);
     void advance(size_t by);
     void copyFromSelf(size_t offset, size_t length);
+    // Hints the CPU to start loading the source of a match that will be copied soon
+    void prefetchFromSelf(size_t offset, size_t length) const;
+    // The lengths below must not exceed the window size, which the decoder ensures
     void copyFromBitstream(BitStream& stream, size_t length);
-    uint8_t* pastView(size_t len);
+    // Copies the last `len` bytes written to the window into `output`
+    void copyPastInto(uint8_t* output, size_t len) const;
+    // Copies `len` bytes starting `back` bytes behind the current position into `output`
+    void copyPastInto(uint8_t* output, size_t back, size_t len) const;
+    // Returns the last `len` bytes written to the window, valid until the window is modified.
+    // Null if they wrap around the ring and there is no memory to gather them.
+    const uint8_t* pastView(size_t len);
+
+    // Called before every chunk, see `WindowBuffer::beginWrite`
+    void beginWrite() { this->data.beginWrite(); }
 
-    Window(size_t size) : data(size), position(0) {}
+    Window(size_t size, std::pmr::memory_resource* resource) : data(size, resource), position(0), scratch(resource) {}
+    // Copies `other`, allocating from `resource`
+    Window(const Window& other, std::pmr::memory_resource* resource) : data(other.data, resource), position(other.position), scratch(resource) {}
 };
 
-} // namespace lzxd::detail
\ No newline at end of file
+// Copies between ranges that do not overlap. Matches are mostly a few dozen bytes, which are copied
+// with fixed-size moves, the last one overlapping the previous one, instead of calling `memcpy`.
+// Kernels built for AVX2 move 32 bytes at once.
+LZXD_HOT_INLINE void copyBytes(uint8_t* dst, const uint8_t* src, size_t length) {
+    if (length >= 32) {
+        for (size_t i = 0; i + 32 < length; i += 32) {
+            std::memcpy(dst + i, src + i, 32);
+        }
+        std::memcpy(dst + length - 32, src + length - 32, 32);
+    } else if (length >= 16) {
+        std::memcpy(dst, src, 16);
+        std::memcpy(dst + length - 16, src + length - 16, 16);
+    } else if (length >= 8) {
+        std::memcpy(dst, src, 8);
+        std::memcpy(dst + length - 8, src + length - 8, 8);
+    } else if (length >= 4) {
+        std::memcpy(dst, src, 4);
+        std::memcpy(dst + length - 4, src + length - 4, 4);
+    } else {
+        for (size_t i = 0; i < length; i++) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+LZXD_HOT_INLINE void Window::push(uint8_t byte) {
+    this->data[this->position] = byte;
+    this->advance(1);
+}
+
+LZXD_HOT_INLINE void Window::advance(size_t by) {
+    this->position += by;
+    if (this->position >= this->data.size()) {
+        this->position -= this->data.size();
+    }
+}
+
+LZXD_HOT_INLINE void Window::copyFromSelf(size_t offset, size_t length) {
+    // For the fast path:
+    // * Source cannot wrap around
+    // * `memmove` won't overwrite as we go but we need that
+    // * Destination cannot wrap around
+
+    if (offset <= this->position && length <= offset && this->position + length < this->data.size()) {
+        auto start = this->position - offset;
+        copyBytes(this->data.data() + this->position, this->data.data() + start, length);
+    } else {
+        auto mask = this->data.size() - 1;
+
+        for (size_t i = 0; i < length; i++) {
+            auto dst = (this->position + i) & mask;
+            auto src = (this->data.size() + this->position + i - offset) & mask;
+            this->data[dst] = this->data[src];
+        }
+    }
+
+    this->advance(length);
+}
+
+// Uncompressed blocks are rare and long, the bytes themselves are copied by `memcpy`
+LZXD_HOT_INLINE void Window::copyFromBitstream(BitStream& stream, size_t length) {
+    LZXD_DEBUG_ASSERT(length <= this->data.size());
+
+    // Copy up to the end of the ring, then wrap around to the start
+    auto head = std::min(length, this->data.size() - this->position);
+    stream.readBytesInto(this->data.data() + this->position, head);
+
+    if (head != length) {
+        stream.readBytesInto(this->data.data(), length - head);
+    }
+
+    this->advance(length);
+}
+
+LZXD_HOT_INLINE void Window::prefetchFromSelf(size_t offset, size_t length) const {
+    auto mask = this->data.size() - 1;
+    auto first = (this->data.size() + this->position - offset) & mask;
+    auto last = (first + length - 1) & mask;
+
+    LZXD_PREFETCH(this->data.data() + first);
+    LZXD_PREFETCH(this->data.data() + last);
+}
+
+} // namespace lzxd::detail
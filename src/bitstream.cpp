@@ -1,7 +1,8 @@
 #include <cstdint>
 #include <lzxd/bitstream.hpp>
+#include <lzxd/config.hpp>
 #include <lzxd/error.hpp>
-#include <stdexcept>
+#include <algorithm>
 #include <cstring>
 #include <bit>
 
@@ -16,18 +17,6 @@
 # define BSWAP64(val) __builtin_bswap64(val)
 #endif
 
-#if defined __BYTE_ORDER__
-# if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-#  define LZXD_LITTLE_ENDIAN
-# elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-#  define LZXD_BIG_ENDIAN
-# endif
-#endif
-
-#if defined _MSC_VER
-# define LZXD_LITTLE_ENDIAN // assumption
-#endif
-
 namespace lzxd {
 
 namespace detail {
@@ -37,22 +26,34 @@ namespace detail {
     template<> uint16_t byteswap<uint16_t>(uint16_t input) { return BSWAP16(input); }
     template<> uint32_t byteswap<uint32_t>(uint32_t input) { return BSWAP32(input); }
     template<> uint64_t byteswap<uint64_t>(uint64_t input) { return BSWAP64(input); }
-
-    uint16_t rotleftu16(uint16_t val, uint8_t bits) {
-        // This is identical to Rust's u16::rotate_left
-        return (val << bits) | (val >> (16 - bits));
-    }
 } // namespace detail
 
-BitStream::BitStream(const uint8_t* data, size_t size) : BitStream(std::vector<uint8_t>(data, data + size)) {}
+BitStream::BitStream(const uint8_t* data, size_t size)
+    : m_data(data, size), m_position(0), m_nextNumber(0), m_remainingBits(0) {}
 
-BitStream::BitStream(std::vector<uint8_t> data) : m_data(std::move(data)), m_position(0), m_nextNumber(0), m_remainingBits(0) {}
+// Moving a vector keeps its buffer, so `m_data` stays valid when the stream is moved
+BitStream::BitStream(std::vector<uint8_t> data)
+    : m_storage(std::move(data)), m_data(m_storage), m_position(0), m_nextNumber(0), m_remainingBits(0) {}
 
-std::vector<uint8_t>& BitStream::data() {
-    return m_data;
+BitStream::BitStream(const BitStream& other) {
+    *this = other;
+}
+
+BitStream& BitStream::operator=(const BitStream& other) {
+    if (this == &other) {
+        return *this;
+    }
+
+    m_storage = other.m_storage;
+    m_data = other.m_storage.empty() ? other.m_data : std::span<const uint8_t>(m_storage);
+    m_position = other.m_position;
+    m_nextNumber = other.m_nextNumber;
+    m_remainingBits = other.m_remainingBits;
+    m_overflowed = other.m_overflowed;
+    return *this;
 }
 
-const std::vector<uint8_t>& BitStream::data() const {
+std::span<const uint8_t> BitStream::data() const {
     return m_data;
 }
 
@@ -68,15 +69,30 @@ size_t BitStream::remainingBytes() const {
     return m_data.size() - m_position;
 }
 
-bool BitStream::eof() const {
-    return m_position >= m_data.size();
+bool BitStream::overflowed() const {
+    return m_overflowed;
 }
 
-uint8_t BitStream::readByte() {
-    this->_failIfEof();
-    uint8_t byte = m_data[m_position];
-    this->_advanceBytes(1);
-    return byte;
+detail::BitCursor BitStream::cursor() const {
+    // The unread bits of the current word are the top `m_remainingBits` of `m_nextNumber`
+    uint64_t bits = m_remainingBits == 0 ? 0 : uint64_t(m_nextNumber >> (16 - m_remainingBits)) << (64 - m_remainingBits);
+    return {m_data.data() + m_position, bits, m_remainingBits};
+}
+
+void BitStream::setCursor(const detail::BitCursor& cursor) {
+    // Words loaded into the cursor but not started are read again, the one in progress becomes current
+    m_position = static_cast<size_t>(cursor.next - m_data.data()) - cursor.count / 16 * sizeof(uint16_t);
+    m_remainingBits = cursor.count % 16;
+    m_nextNumber = 0;
+
+    if (m_remainingBits != 0) {
+        uint16_t word;
+        std::memcpy(&word, m_data.data() + m_position - sizeof(uint16_t), sizeof(uint16_t));
+#ifdef LZXD_BIG_ENDIAN
+        word = detail::byteswap(word);
+#endif
+        m_nextNumber = detail::rotleftu16(word, 16 - m_remainingBits);
+    }
 }
 
 uint32_t BitStream::readU32le() {
@@ -117,7 +133,15 @@ void BitStream::align() {
 }
 
 std::vector<uint8_t> BitStream::intoVector() {
-    return std::move(m_data);
+    std::vector<uint8_t> ret = m_storage.empty() ? std::vector<uint8_t>(m_data.begin(), m_data.end()) : std::move(m_storage);
+
+    m_storage.clear();
+    m_data = {};
+    m_position = 0;
+    m_nextNumber = 0;
+    m_remainingBits = 0;
+    m_overflowed = false;
+    return ret;
 }
 
 std::vector<uint8_t> BitStream::readBytes(size_t count) {
@@ -140,141 +164,23 @@ void BitStream::readBytesInto(uint8_t* output, size_t count) {
 void BitStream::peekBytesInto(uint8_t* output, size_t count) const {
     auto startPos = m_position;
 
-    if (startPos + count > m_data.size()) {
+    if (count > m_data.size() - startPos) {
         this->_oob();
+        std::fill(output, output + count, 0);
+        return;
     }
 
     std::copy(m_data.begin() + startPos, m_data.begin() + startPos + count, output);
 }
 
-bool BitStream::_readBit() {
-    if (m_remainingBits == 0) {
-        this->_advanceBuffer();
-    }
-
-    m_remainingBits--;
-    m_nextNumber = detail::rotleftu16(m_nextNumber, 1);
-    return m_nextNumber & 1;
-}
-
-uint16_t BitStream::_readBitsOneWord(size_t size) {
-    LZXD_ASSERT(size <= 16);
-
-    if (size <= m_remainingBits) {
-        this->m_remainingBits -= size;
-
-        // rotate `m_nextNumber` left by `size` bits
-        m_nextNumber = detail::rotleftu16(m_nextNumber, size);
-
-        return m_nextNumber & ((1 << size) - 1);
-    }
-
-    uint16_t hi = detail::rotleftu16(m_nextNumber, m_remainingBits) & ((1 << m_remainingBits) - 1);
-    size -= m_remainingBits;
-    this->_advanceBuffer();
-
-    m_remainingBits -= size;
-    this->m_nextNumber = detail::rotleftu16(m_nextNumber, size);
-
-    // `bits` may be 16 which would overflow the left shift, operate on `u32` and trunc.
-    uint16_t lo = m_nextNumber & (((uint16_t)(1ul << size)) - 1);
-
-    return (uint16_t)((uint32_t)hi << size) | lo;
-}
-
-uint32_t BitStream::_readBits(size_t count) {
-    if (count <= 16) {
-        return this->_readBitsOneWord(count);
-    }
-
-    LZXD_ASSERT(count <= 32);
-
-    auto hi = this->_readBitsOneWord(16);
-    auto lo = this->_readBitsOneWord(count - 16);
-
-    return (hi << (count - 16)) | lo;
-}
-
-uint16_t BitStream::_peekBitsOneWord(size_t count) {
-    LZXD_ASSERT(count <= 16);
-
-    if (count <= m_remainingBits) {
-        return detail::rotleftu16(m_nextNumber, count) & static_cast<uint16_t>((1 << count) - 1);
-    }
-
-    uint16_t hi = detail::rotleftu16(m_nextNumber, m_remainingBits) & ((1 << m_remainingBits) - 1);
-    count -= m_remainingBits;
-
-    // We may peek more than we need (i.e. at the end of a chunk), due to the way
-    // our decoder is implemented. This is a bit ugly but luckily we can pretend
-    // there are just zeros after.
-    uint16_t n;
-    if (this->eof()) {
-        n = 0;
-    } else {
-        std::memcpy(&n, m_data.data() + m_position, sizeof(uint16_t));
-#ifdef LZXD_BIG_ENDIAN
-        n = detail::byteswap(n);
-#endif
-    }
-
-    uint16_t lo = detail::rotleftu16(n, count) & (((uint16_t)(1ul << count)) - 1);
-    return (uint16_t)((uint32_t)hi << count) | lo;
-}
-
-uint32_t BitStream::_peekBits(size_t count) {
-    if (count <= 16) {
-        return this->_peekBitsOneWord(count);
-    }
-
-    LZXD_ASSERT(count <= 32);
-
-    // Store state of the bitstream
-    struct State {
-        uint16_t nextNumber;
-        uint8_t remainingBits;
-        size_t position;
-    } state = {m_nextNumber, m_remainingBits, m_position};
-
-    uint16_t hi = this->_readBitsOneWord(16);
-    uint16_t lo = this->_peekBitsOneWord(count - 16);
-
-    // Restore state of the bitstream
-    m_nextNumber = state.nextNumber;
-    m_remainingBits = state.remainingBits;
-    m_position = state.position;
-
-    return (hi << (count - 16)) | lo;
-}
-
-void BitStream::_oob() const {
-    throw std::out_of_range("Out of bounds");
-}
-
-void BitStream::_failIfEof() const {
-    if (this->eof()) {
+void BitStream::_advanceBytes(size_t count) {
+    if (count > m_data.size() - m_position) {
         this->_oob();
+        m_position = m_data.size();
+        return;
     }
-}
 
-void BitStream::_advanceBuffer() {
-    this->_failIfEof();
-    this->m_remainingBits = 16;
-    std::memcpy(&m_nextNumber, m_data.data() + m_position, sizeof(uint16_t));
-
-    // Since we read a little-endian integer, byteswap if we are on a big-endian architecture
-#ifdef LZXD_BIG_ENDIAN
-    m_nextNumber = detail::byteswap(m_nextNumber);
-#endif
-
-    m_position += sizeof(uint16_t);
-}
-
-void BitStream::_advanceBytes(size_t count) {
     m_position += count;
-    if (m_position > m_data.size()) {
-        this->_oob();
-    }
 }
 
 } // namespace lzxd
@@ -0,0 +1,342 @@
+#include <lzxd/cache.hpp>
+#include "hash.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <utility>
+
+#ifdef __linux__
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+namespace lzxd {
+
+namespace fs = std::filesystem;
+
+// Every entry starts with the magic, the format version, the size of the data following it, which
+// catches entries left truncated by a crash, and a hash of that data, which catches any other damage
+static constexpr char ENTRY_MAGIC[8] = {'L', 'Z', 'X', 'D', 'C', 'A', 'C', 'H'};
+static constexpr uint64_t ENTRY_VERSION = 2;
+static constexpr size_t ENTRY_HEADER_SIZE = 32;
+static constexpr uint64_t ENTRY_HASH_SEED = 0x6c7a7864;
+static constexpr const char* ENTRY_EXTENSION = ".lzxd";
+// Temporary files this old were left behind by a writer that died
+static constexpr auto STALE_TEMP_AGE = std::chrono::hours(1);
+
+static uint64_t readU64le(const uint8_t* data) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; i++) {
+        value |= uint64_t(data[i]) << (i * 8);
+    }
+    return value;
+}
+
+static void writeU64le(uint8_t* data, uint64_t value) {
+    for (size_t i = 0; i < 8; i++) {
+        data[i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+}
+
+// Whether `header` is that of an entry of this version holding `size` bytes
+static bool validHeader(const uint8_t* header, uint64_t size) {
+    return std::memcmp(header, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) == 0 && readU64le(header + 8) == ENTRY_VERSION
+        && readU64le(header + 16) == size;
+}
+
+static bool validData(const uint8_t* header, const uint8_t* data, size_t size) {
+    return readU64le(header + 24) == detail::hash64(data, size, ENTRY_HASH_SEED);
+}
+
+static std::string tempSuffix() {
+    static std::atomic<uint64_t> counter = 0;
+
+#ifdef __linux__
+    uint64_t process = static_cast<uint64_t>(getpid());
+#else
+    static uint64_t process = std::random_device{}();
+#endif
+
+    return ".tmp." + std::to_string(process) + "." + std::to_string(counter++);
+}
+
+CachedBuffer::CachedBuffer(std::vector<uint8_t> data) : m_owned(std::move(data)) {
+    m_data = m_owned.data();
+    m_size = m_owned.size();
+}
+
+CachedBuffer::CachedBuffer(CachedBuffer&& other) noexcept {
+    *this = std::move(other);
+}
+
+CachedBuffer& CachedBuffer::operator=(CachedBuffer&& other) noexcept {
+    if (this != &other) {
+        this->release();
+
+        m_mapping = std::exchange(other.m_mapping, nullptr);
+        m_mappingSize = std::exchange(other.m_mappingSize, 0);
+        m_owned = std::move(other.m_owned);
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+    }
+
+    return *this;
+}
+
+CachedBuffer::~CachedBuffer() {
+    this->release();
+}
+
+void CachedBuffer::release() {
+#ifdef __linux__
+    if (m_mapping) {
+        munmap(m_mapping, m_mappingSize);
+    }
+#endif
+
+    m_mapping = nullptr;
+    m_mappingSize = 0;
+    m_owned.clear();
+    m_data = nullptr;
+    m_size = 0;
+}
+
+DiskCache::DiskCache(fs::path directory, uint64_t maxSize) : m_directory(std::move(directory)), m_maxSize(maxSize) {}
+
+uint64_t DiskCache::key(const uint8_t* data, size_t size, size_t windowSize, size_t outputSize, size_t chunkSize) {
+    uint8_t params[24];
+    for (size_t i = 0; i < 8; i++) {
+        params[i] = static_cast<uint8_t>(uint64_t(windowSize) >> (i * 8));
+        params[8 + i] = static_cast<uint8_t>(uint64_t(outputSize) >> (i * 8));
+        params[16 + i] = static_cast<uint8_t>(uint64_t(chunkSize) >> (i * 8));
+    }
+
+    return detail::hash64(data, size, detail::hash64(params, sizeof(params), 0));
+}
+
+fs::path DiskCache::entryPath(uint64_t key) const {
+    char name[17];
+    for (size_t i = 0; i < 16; i++) {
+        name[i] = "0123456789abcdef"[(key >> (60 - i * 4)) & 0xF];
+    }
+    name[16] = '\0';
+
+    return (m_directory / name).concat(ENTRY_EXTENSION);
+}
+
+std::optional<CachedBuffer> DiskCache::find(uint64_t key) const {
+    auto path = this->entryPath(key);
+    uint8_t header[ENTRY_HEADER_SIZE];
+
+#ifdef __linux__
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || size_t(info.st_size) < ENTRY_HEADER_SIZE || pread(fd, header, sizeof(header), 0) != ssize_t(sizeof(header))) {
+        close(fd);
+        return std::nullopt;
+    }
+
+    size_t fileSize = size_t(info.st_size);
+    if (!validHeader(header, fileSize - ENTRY_HEADER_SIZE)) {
+        close(fd);
+        return std::nullopt;
+    }
+
+    void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(fd);
+        return std::nullopt;
+    }
+
+    if (!validData(header, static_cast<const uint8_t*>(mapping) + ENTRY_HEADER_SIZE, fileSize - ENTRY_HEADER_SIZE)) {
+        munmap(mapping, fileSize);
+        close(fd);
+        return std::nullopt;
+    }
+
+    // Refresh the modification time, which orders entries for eviction
+    futimens(fd, nullptr);
+    close(fd);
+
+    CachedBuffer buffer;
+    buffer.m_mapping = mapping;
+    buffer.m_mappingSize = fileSize;
+    buffer.m_data = static_cast<const uint8_t*>(mapping) + ENTRY_HEADER_SIZE;
+    buffer.m_size = fileSize - ENTRY_HEADER_SIZE;
+    return buffer;
+#else
+    // No mapping, read the entry into memory instead
+    std::ifstream file(path, std::ios::binary);
+    if (!file.read(reinterpret_cast<char*>(header), sizeof(header))) {
+        return std::nullopt;
+    }
+
+    std::error_code ec;
+    auto fileSize = fs::file_size(path, ec);
+    if (ec || fileSize < ENTRY_HEADER_SIZE || !validHeader(header, fileSize - ENTRY_HEADER_SIZE)) {
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> data(fileSize - ENTRY_HEADER_SIZE);
+    if (!file.read(reinterpret_cast<char*>(data.data()), data.size()) || !validData(header, data.data(), data.size())) {
+        return std::nullopt;
+    }
+
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    return CachedBuffer(std::move(data));
+#endif
+}
+
+bool DiskCache::store(uint64_t key, const uint8_t* data, size_t size) {
+    std::error_code ec;
+    fs::create_directories(m_directory, ec);
+
+    auto path = this->entryPath(key);
+    auto temp = path;
+    temp += tempSuffix();
+
+    uint8_t header[ENTRY_HEADER_SIZE];
+    std::memcpy(header, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+    writeU64le(header + 8, ENTRY_VERSION);
+    writeU64le(header + 16, size);
+    writeU64le(header + 24, detail::hash64(data, size, ENTRY_HASH_SEED));
+
+    {
+        std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(data), size);
+        file.close();
+
+        if (!file) {
+            fs::remove(temp, ec);
+            return false;
+        }
+    }
+
+#ifdef __linux__
+    // The data must reach the disk before the rename does, or a crash could leave a complete-looking entry of zeros
+    int fd = open(temp.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+
+    // Atomically replaces any entry a concurrent writer stored in the meantime, which holds the same data
+    fs::rename(temp, path, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return false;
+    }
+
+    // Only the first store scans the directory, later ones count what they add
+    if (!m_scanned.exchange(true)) {
+        m_knownSize = this->totalSize();
+    } else {
+        m_knownSize += ENTRY_HEADER_SIZE + size;
+    }
+
+    if (m_knownSize > m_maxSize) {
+        this->evict();
+    }
+
+    return true;
+}
+
+Result<CachedBuffer> DiskCache::getOrDecode(uint64_t key, const std::function<Result<std::vector<uint8_t>>()>& decode) {
+    if (auto buffer = this->find(key)) {
+        return std::move(*buffer);
+    }
+
+    auto result = decode();
+    if (!result) {
+        return result.error();
+    }
+
+    this->store(key, result.value().data(), result.value().size());
+    return CachedBuffer(std::move(result.value()));
+}
+
+void DiskCache::evict() {
+    struct Entry {
+        fs::path path;
+        fs::file_time_type time;
+        uint64_t size;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    auto now = fs::file_time_type::clock::now();
+
+    std::error_code iterEc, ec;
+    for (auto it = fs::directory_iterator(m_directory, iterEc); !iterEc && it != fs::directory_iterator(); it.increment(iterEc)) {
+        auto& path = it->path();
+        auto time = it->last_write_time(ec);
+        if (ec) {
+            continue;
+        }
+
+        if (path.filename().string().find(".tmp.") != std::string::npos) {
+            if (now - time > STALE_TEMP_AGE) {
+                fs::remove(path, ec);
+            }
+            continue;
+        }
+
+        if (path.extension() != ENTRY_EXTENSION) {
+            continue;
+        }
+
+        auto size = it->file_size(ec);
+        if (!ec) {
+            entries.push_back({path, time, size});
+            total += size;
+        }
+    }
+
+    if (total <= m_maxSize) {
+        m_knownSize = total;
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.time < b.time; });
+
+    // Removing an entry that another process has mapped is fine, its mapping stays valid
+    for (auto& entry : entries) {
+        if (total <= m_maxSize) {
+            break;
+        }
+
+        if (fs::remove(entry.path, ec)) {
+            total -= entry.size;
+        }
+    }
+
+    m_knownSize = total;
+}
+
+uint64_t DiskCache::totalSize() const {
+    uint64_t total = 0;
+
+    std::error_code iterEc, ec;
+    for (auto it = fs::directory_iterator(m_directory, iterEc); !iterEc && it != fs::directory_iterator(); it.increment(iterEc)) {
+        if (it->path().extension() == ENTRY_EXTENSION) {
+            auto size = it->file_size(ec);
+            total += ec ? 0 : size;
+        }
+    }
+
+    return total;
+}
+
+} // namespace lzxd
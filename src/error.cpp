@@ -23,4 +23,32 @@ void _assertfail(const char* message, const char* file, int line) {
     std::abort();
 }
 
-} // namespace lzxd
\ No newline at end of file
+const char* errorMessage(ErrorCode code) {
+    switch (code) {
+        case ErrorCode::Ok: return "no error";
+        case ErrorCode::InvalidWindowSize: return "invalid window size";
+        case ErrorCode::ChunkTooLarge: return "chunk is larger than the window";
+        case ErrorCode::UnexpectedEof: return "unexpected end of chunk";
+        case ErrorCode::InvalidBlockHeader: return "invalid block header";
+        case ErrorCode::InvalidTree: return "invalid tree path lengths";
+        case ErrorCode::InvalidPretreeCode: return "invalid pretree code";
+        case ErrorCode::InvalidMatch: return "invalid match";
+        case ErrorCode::MatchOutOfBounds: return "match offset is out of bounds";
+        case ErrorCode::E8NotImplemented: return "E8 translation not implemented";
+        case ErrorCode::InvalidChunkTable: return "invalid chunk offset table";
+        case ErrorCode::OutputTooSmall: return "output segments are smaller than the chunk";
+        case ErrorCode::OutOfMemory: return "out of memory";
+        default: return "unknown error";
+    }
+}
+
+void _raise(ErrorCode code) {
+#if LZXD_EXCEPTIONS
+    throw LzxdError(code);
+#else
+    std::cerr << "lzxd: " << errorMessage(code) << std::endl;
+    std::abort();
+#endif
+}
+
+} // namespace lzxd
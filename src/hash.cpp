@@ -0,0 +1,79 @@
+#include "hash.hpp"
+
+namespace lzxd::detail {
+
+// XXH64
+static constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+static constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr uint64_t PRIME3 = 0x165667B19E3779F9ull;
+static constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+static constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+
+static uint64_t readU64le(const uint8_t* data) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; i++) {
+        value |= uint64_t(data[i]) << (i * 8);
+    }
+    return value;
+}
+
+static uint32_t readU32le(const uint8_t* data) {
+    return uint32_t(data[0]) | (uint32_t(data[1]) << 8) | (uint32_t(data[2]) << 16) | (uint32_t(data[3]) << 24);
+}
+
+static uint64_t rotl64(uint64_t value, int count) {
+    return (value << count) | (value >> (64 - count));
+}
+
+static uint64_t hashRound(uint64_t acc, uint64_t input) {
+    return rotl64(acc + input * PRIME2, 31) * PRIME1;
+}
+
+static uint64_t hashMerge(uint64_t acc, uint64_t value) {
+    return (acc ^ hashRound(0, value)) * PRIME1 + PRIME4;
+}
+
+uint64_t hash64(const uint8_t* data, size_t size, uint64_t seed) {
+    const uint8_t* end = data + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+
+        for (; data + 32 <= end; data += 32) {
+            v1 = hashRound(v1, readU64le(data));
+            v2 = hashRound(v2, readU64le(data + 8));
+            v3 = hashRound(v3, readU64le(data + 16));
+            v4 = hashRound(v4, readU64le(data + 24));
+        }
+
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = hashMerge(hashMerge(hashMerge(hashMerge(hash, v1), v2), v3), v4);
+    } else {
+        hash = seed + PRIME5;
+    }
+
+    hash += size;
+
+    for (; data + 8 <= end; data += 8) {
+        hash = rotl64(hash ^ hashRound(0, readU64le(data)), 27) * PRIME1 + PRIME4;
+    }
+
+    if (data + 4 <= end) {
+        hash = rotl64(hash ^ (uint64_t(readU32le(data)) * PRIME1), 23) * PRIME2 + PRIME3;
+        data += 4;
+    }
+
+    for (; data < end; data++) {
+        hash = rotl64(hash ^ (*data * PRIME5), 11) * PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+} // namespace lzxd::detail
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace lzxd::detail {
+
+// XXH64 of `data`
+uint64_t hash64(const uint8_t* data, size_t size, uint64_t seed);
+
+} // namespace lzxd::detail
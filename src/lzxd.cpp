@@ -1,6 +1,9 @@
 #include <lzxd/lzxd.hpp>
 #include <lzxd/error.hpp>
+#include <lzxd/tree_cache.hpp>
+#include <algorithm>
 #include <bit>
+#include <tuple>
 #include <cstring>
 
 namespace lzxd {
@@ -31,22 +34,148 @@ namespace detail {
             case 0x2000000: // 32 MiB
                 return 290;
             default:
-                throw LzxdError("positionSlotsFor: invalid window size");
+                return 0;
         }
     }
 } // namespace detail
 
-Decoder::Decoder(size_t windowSize)
-    : windowSize(windowSize),
-      window(windowSize),
-      mainTree(std::vector<uint8_t>(256 + 8 * detail::positionSlotsFor(windowSize))),
-      lengthTree(std::vector<uint8_t>(249)),
+// Invalid window sizes raise right away, unless exceptions are disabled. In that case the decoder
+// is left with an empty window and every chunk fails with `ErrorCode::InvalidWindowSize`.
+static size_t checkWindowSize(size_t windowSize) {
+    if (detail::positionSlotsFor(windowSize) != 0) {
+        return windowSize;
+    }
+
+#if LZXD_EXCEPTIONS
+    _raise(ErrorCode::InvalidWindowSize);
+#else
+    return 0;
+#endif
+}
+
+Decoder::Decoder(size_t windowSize, std::pmr::memory_resource* resource)
+    : windowSize(checkWindowSize(windowSize)),
+      resource(resource),
+      prefetchMinOffset(windowSize >= detail::PREFETCH_MIN_WINDOW_SIZE ? detail::PREFETCH_MIN_OFFSET : SIZE_MAX),
+      window(this->windowSize, resource),
+      mainTree(std::pmr::vector<uint8_t>(256 + 8 * detail::positionSlotsFor(this->windowSize), resource)),
+      lengthTree(std::pmr::vector<uint8_t>(249, resource)),
       currentBlock(UncompressedBlock {
         BaseBlock {0, 0},
         1, 1, 1
-      }) {}
+      }),
+      decodeLoop(&Decoder::decodeLoopScalar),
+      mainTreeInstance(resource),
+      lengthTreeInstance(resource),
+      alignedOffsetTree(resource),
+      pretree(resource) {
+    this->reserveTrees();
+    this->setKernel(kernelSupported(DecodeKernel::Avx2) ? DecodeKernel::Avx2 : DecodeKernel::Scalar);
+}
 
-Decoder::Decoder() : Decoder(0x80000) {}
+Decoder::Decoder(const Decoder& other) : Decoder(other, other.resource) {}
+
+// Every buffer is copied with `resource`, the copy constructors of `std::pmr` containers would use the default one
+Decoder::Decoder(const Decoder& other, std::pmr::memory_resource* resource)
+    : windowSize(other.windowSize),
+      resource(resource),
+      prefetchMinOffset(other.prefetchMinOffset),
+      decodedChunks(other.decodedChunks),
+      window(other.window, resource),
+      mainTree(other.mainTree, resource),
+      lengthTree(other.lengthTree, resource),
+      r0(other.r0), r1(other.r1), r2(other.r2),
+      chunkOffset(other.chunkOffset),
+      currentBlock(other.currentBlock),
+      e8Translator(other.e8Translator),
+      activeKernel(other.activeKernel),
+      decodeLoop(other.decodeLoop),
+      mainTreeInstance(other.mainTreeInstance, resource),
+      lengthTreeInstance(other.lengthTreeInstance, resource),
+      alignedOffsetTree(other.alignedOffsetTree, resource),
+      pretree(other.pretree, resource),
+      treeCache(other.treeCache),
+      sharedMainTree(other.sharedMainTree),
+      sharedLengthTree(other.sharedLengthTree)
+#if defined(LZXD_ENABLE_PROFILING)
+      , profiler(other.profiler)
+#endif
+{
+    // Copied buffers only hold what is in use
+    this->reserveTrees();
+}
+
+Decoder& Decoder::operator=(const Decoder& other) {
+    if (this != &other) {
+        *this = Decoder(other, this->resource);
+    }
+
+    return *this;
+}
+
+Decoder& Decoder::operator=(Decoder&& other) {
+    if (this == &other) {
+        return *this;
+    }
+
+    // Buffers can only be taken over if they come from the same resource
+    if (other.resource != this->resource) {
+        return *this = static_cast<const Decoder&>(other);
+    }
+
+    this->windowSize = other.windowSize;
+    this->prefetchMinOffset = other.prefetchMinOffset;
+    this->decodedChunks = other.decodedChunks;
+    this->window = std::move(other.window);
+    this->mainTree = std::move(other.mainTree);
+    this->lengthTree = std::move(other.lengthTree);
+    this->r0 = other.r0;
+    this->r1 = other.r1;
+    this->r2 = other.r2;
+    this->chunkOffset = other.chunkOffset;
+    this->currentBlock = other.currentBlock;
+    this->e8Translator = other.e8Translator;
+    this->activeKernel = other.activeKernel;
+    this->decodeLoop = other.decodeLoop;
+    this->mainTreeInstance = std::move(other.mainTreeInstance);
+    this->lengthTreeInstance = std::move(other.lengthTreeInstance);
+    this->alignedOffsetTree = std::move(other.alignedOffsetTree);
+    this->pretree = std::move(other.pretree);
+    this->treeCache = std::move(other.treeCache);
+    this->sharedMainTree = std::move(other.sharedMainTree);
+    this->sharedLengthTree = std::move(other.sharedLengthTree);
+#if defined(LZXD_ENABLE_PROFILING)
+    this->profiler = std::move(other.profiler);
+#endif
+
+    return *this;
+}
+
+void Decoder::reserveTrees() {
+    // Every buffer is sized for the largest possible tree up front, decoding never allocates after this
+    this->mainTreeInstance.reserve(this->mainTree.m_lengths.size(), 16, true);
+    this->lengthTreeInstance.reserve(this->lengthTree.m_lengths.size(), 16, false);
+    this->alignedOffsetTree.reserve(8, 7, false);
+    this->pretree.reserve(20, 15, false);
+}
+
+Decoder Decoder::clone() {
+    // The copy maps the snapshot, or copies the window if it could not be taken
+    this->window.data.snapshot();
+
+    return Decoder(*this);
+}
+
+Decoder::Decoder() : Decoder(DEFAULT_WINDOW_SIZE) {}
+
+template <typename T>
+static T unwrap(Result<T> result) {
+    if (!result) {
+        _raise(result.error());
+    }
+
+    return std::move(result.value());
+}
 
 std::vector<uint8_t> Decoder::decompressChunk(const std::vector<uint8_t>& data, size_t outputSize) {
     return this->decompressChunk(data.data(), data.size(), outputSize);
@@ -64,76 +193,805 @@ size_t Decoder::decompressChunkInto(const std::vector<uint8_t>& data, uint8_t* o
 }
 
 size_t Decoder::decompressChunkInto(const uint8_t* data, size_t size, uint8_t* output, size_t outputSize) {
-    BitStream stream(data, size);
+    return unwrap(this->tryDecompressChunkInto(data, size, output, outputSize));
+}
+
+size_t Decoder::decompressChunkScatter(const std::vector<uint8_t>& data, std::span<const OutputSegment> segments, size_t outputSize) {
+    return this->decompressChunkScatter(data.data(), data.size(), segments, outputSize);
+}
+
+size_t Decoder::decompressChunkScatter(const uint8_t* data, size_t size, std::span<const OutputSegment> segments, size_t outputSize) {
+    return unwrap(this->tryDecompressChunkScatter(data, size, segments, outputSize));
+}
+
+std::span<const uint8_t> Decoder::decompressChunkView(const std::vector<uint8_t>& data, size_t outputSize) {
+    return this->decompressChunkView(data.data(), data.size(), outputSize);
+}
+
+std::span<const uint8_t> Decoder::decompressChunkView(const uint8_t* data, size_t size, size_t outputSize) {
+    return unwrap(this->tryDecompressChunkView(data, size, outputSize));
+}
+
+size_t Decoder::validateChunk(const std::vector<uint8_t>& data, size_t outputSize) {
+    return this->validateChunk(data.data(), data.size(), outputSize);
+}
+
+size_t Decoder::validateChunk(const uint8_t* data, size_t size, size_t outputSize) {
+    return unwrap(this->tryValidateChunk(data, size, outputSize));
+}
+
+size_t Decoder::skipChunk(const std::vector<uint8_t>& data, size_t outputSize) {
+    return this->skipChunk(data.data(), data.size(), outputSize);
+}
+
+size_t Decoder::skipChunk(const uint8_t* data, size_t size, size_t outputSize) {
+    return unwrap(this->trySkipChunk(data, size, outputSize));
+}
+
+Result<size_t> Decoder::tryDecompressChunkInto(const uint8_t* data, size_t size, uint8_t* output, size_t outputSize) noexcept {
+    ChunkState state(BitStream(data, size), outputSize);
+    state.output = output;
+    return this->decodeChunk(state);
+}
+
+Result<size_t> Decoder::tryDecompressChunkScatter(const uint8_t* data, size_t size, std::span<const OutputSegment> segments, size_t outputSize) noexcept {
+    size_t capacity = 0;
+    for (auto& segment : segments) {
+        capacity += segment.length;
+    }
+
+    if (capacity < outputSize) {
+        return ErrorCode::OutputTooSmall;
+    }
+
+    ChunkState state(BitStream(data, size), outputSize);
+    state.segments = segments;
+    return this->decodeChunk(state);
+}
+
+Result<std::span<const uint8_t>> Decoder::tryDecompressChunkView(const uint8_t* data, size_t size, size_t outputSize) noexcept {
+    ChunkState state(BitStream(data, size), outputSize);
+    state.view = true;
+
+    auto result = this->decodeChunk(state);
+    if (!result) {
+        return result.error();
+    }
+
+    // Chunks never wrap around the ring when their size divides the window, so this is rarely a copy
+    auto view = this->window.pastView(result.value());
+    if (!view) {
+        return ErrorCode::OutOfMemory;
+    }
+
+    return std::span<const uint8_t>(view, result.value());
+}
+
+Result<size_t> Decoder::tryValidateChunk(const uint8_t* data, size_t size, size_t outputSize) noexcept {
+    ChunkState state(BitStream(data, size), outputSize);
+    return this->decodeChunk(state);
+}
+
+Result<size_t> Decoder::trySkipChunk(const uint8_t* data, size_t size, size_t outputSize) noexcept {
+    ChunkState state(BitStream(data, size), outputSize);
+    return this->decodeChunk(state);
+}
+
+Result<size_t> Decoder::decodeChunk(ChunkState& state) {
+    if (auto err = this->beginChunk(state); err != ErrorCode::Ok) {
+        return err;
+    }
+
+    if (auto err = (this->*decodeLoop)(state); err != ErrorCode::Ok) {
+        return err;
+    }
+
+    return this->finishChunk(state);
+}
+
+#if defined(LZXD_ENABLE_PROFILING)
+const Profile& Decoder::profile() const {
+    return this->profiler.profile;
+}
+
+void Decoder::resetProfile() {
+    this->profiler.profile.reset();
+}
+#endif
+
+DecodeKernel Decoder::kernel() const {
+    return this->activeKernel;
+}
+
+bool Decoder::setKernel(DecodeKernel kernel) {
+    if (!kernelSupported(kernel)) {
+        return false;
+    }
+
+    this->activeKernel = kernel;
+    this->decodeLoop = kernel == DecodeKernel::Avx2 ? &Decoder::decodeLoopAvx2 : &Decoder::decodeLoopScalar;
+    return true;
+}
+
+void Decoder::setTreeCache(std::shared_ptr<TreeCache> cache) {
+    this->treeCache = std::move(cache);
+}
+
+bool Decoder::kernelSupported(DecodeKernel kernel) {
+    switch (kernel) {
+        case DecodeKernel::Scalar:
+            return true;
+
+        case DecodeKernel::Avx2:
+#if LZXD_X86_DISPATCH
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2");
+#else
+            return false;
+#endif
+
+        default:
+            return false;
+    }
+}
+
+template <bool Record>
+LZXD_ALWAYS_INLINE ErrorCode Decoder::decodeSteps(ChunkState& state) {
+    while (state.decodedLen != state.outputSize) {
+        if (auto err = this->decodeStep<Record>(state); err != ErrorCode::Ok) {
+            return err;
+        }
+    }
+
+    return ErrorCode::Ok;
+}
+
+ErrorCode Decoder::decodeLoopScalar(ChunkState& state) {
+    return this->decodeSteps(state);
+}
+
+// The same loop compiled for AVX2 and BMI2, the compiler uses `shrx`/`bzhi` for the bit extraction
+// and wider moves for copies. Only called if the CPU supports both.
+#if LZXD_X86_DISPATCH
+[[gnu::target("avx2,bmi,bmi2")]]
+ErrorCode Decoder::decodeLoopAvx2(ChunkState& state) {
+    return this->decodeSteps(state);
+}
+#else
+ErrorCode Decoder::decodeLoopAvx2(ChunkState& state) {
+    return this->decodeSteps(state);
+}
+#endif
+
+Result<size_t> Decoder::recordChunk(const uint8_t* data, size_t size, size_t outputSize, detail::ChunkTokens& tokens) noexcept {
+    ChunkState state(BitStream(data, size), outputSize);
+    state.tokens = &tokens;
+    tokens.clear();
+
+    if (auto err = this->beginChunk(state); err != ErrorCode::Ok) {
+        return err;
+    }
+
+    if (auto err = this->decodeSteps<true>(state); err != ErrorCode::Ok) {
+        return err;
+    }
+
+    return this->finishChunk(state);
+}
+
+void Decoder::decompressInterleaved(std::span<InterleavedChunk> chunks) {
+    // Decoding is one long dependency chain per stream, alternating between a few streams
+    // lets the CPU overlap their chains. More than 4 streams just adds register pressure.
+    constexpr size_t GROUP = 4;
+
+    for (size_t base = 0; base < chunks.size(); base += GROUP) {
+        size_t count = std::min(GROUP, chunks.size() - base);
+        std::optional<ChunkState> states[GROUP];
+
+        for (size_t i = 0; i < count; i++) {
+            auto& chunk = chunks[base + i];
+            states[i].emplace(BitStream(chunk.data, chunk.size), chunk.outputSize);
+            states[i]->output = chunk.output;
+            chunk.error = chunk.decoder->beginChunk(*states[i]);
+        }
+
+        // The AVX2 loop is only used if every decoder of the group selected it
+        bool avx2 = std::all_of(chunks.begin() + base, chunks.begin() + base + count, [](auto& chunk) {
+            return chunk.decoder->activeKernel == DecodeKernel::Avx2;
+        });
+
+        if (avx2) {
+            interleaveLoopAvx2(chunks.data() + base, states, count);
+        } else {
+            interleaveLoopScalar(chunks.data() + base, states, count);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            auto& chunk = chunks[base + i];
+            if (chunk.error != ErrorCode::Ok) {
+                continue;
+            }
+
+            auto result = chunk.decoder->finishChunk(*states[i]);
+            chunk.error = result.error();
+            chunk.decodedLen = result.ok() ? result.value() : 0;
+        }
+    }
+}
+
+ErrorCode Decoder::beginChunk(ChunkState& state) {
+    if (this->windowSize == 0) {
+        return ErrorCode::InvalidWindowSize;
+    }
+
+    if (state.outputSize > this->windowSize) {
+        return ErrorCode::ChunkTooLarge;
+    }
 
     if (decodedChunks == 0) {
-        this->firstChunk(stream);
+        this->firstChunk(state.stream);
+    }
+
+    // E8 fixups are disabled after 1GB of input data, or if the chunk size is too small. They are not
+    // implemented yet, which is reported before decoding anything so that the decoder is left as it was.
+    // Validating or skipping only needs the window, which is not translated.
+    bool producesOutput = state.output || state.view || !state.segments.empty() || state.tokens;
+    if (producesOutput && this->e8Translator && this->chunkOffset < 0x40000000 && state.outputSize > 10) {
+        // TODO
+        return ErrorCode::E8NotImplemented;
+    }
+
+    this->window.beginWrite();
+
+    // The decoder may have been moved or copied since the block was read
+    this->currentBlock.rebindTrees(
+        this->sharedMainTree ? this->sharedMainTree.get() : &this->mainTreeInstance,
+        this->sharedLengthTree ? this->sharedLengthTree.get() : &this->lengthTreeInstance,
+        &this->alignedOffsetTree
+    );
+
+#if defined(LZXD_ENABLE_PROFILING)
+    this->profiler.beginChunk(this->decodedChunks, state.stream.size());
+
+    // A block carried over from the previous chunk
+    if (this->currentBlock.remaining() != 0) {
+        this->profiler.beginBlock(this->currentBlock.type(), static_cast<uint32_t>(this->currentBlock.size()));
+    }
+#endif
+
+    return ErrorCode::Ok;
+}
+
+template <bool Record>
+LZXD_ALWAYS_INLINE ErrorCode Decoder::decodeStep(ChunkState& state) {
+    auto& stream = state.stream;
+
+    if (this->currentBlock.remaining() == 0) {
+        // Re-align the bitstream to 16 bits, by reading 1 byte
+        if (this->currentBlock.type() == BlockType::Uncompressed && this->currentBlock.size() % 2 != 0) {
+            stream.readByte();
+        }
+
+#if defined(LZXD_ENABLE_PROFILING)
+        // A block ending with the previous chunk was reported by `finishChunk`
+        if (this->currentBlock.size() != 0 && state.decodedLen != 0) {
+            LZXD_PROBE(block_end, static_cast<int>(this->currentBlock.type()), this->currentBlock.size());
+        }
+#endif
+
+        auto header = lzxd::readBlockHeader(stream);
+        LZXD_PROFILE(this->profiler.beginBlock(header.type, header.size));
+        LZXD_PROFILE_PHASE(this->profiler, Phase::Trees);
+
+        if (auto err = this->readBlock(stream, header, this->currentBlock); err != ErrorCode::Ok) {
+            return err;
+        }
     }
 
-    size_t decodedLen = 0;
-    while (decodedLen != outputSize) {
-        if (this->currentBlock.remaining() == 0) {
-            // Re-align the bitstream to 16 bits, by reading 1 byte
-            if (this->currentBlock.type() == BlockType::Uncompressed && this->currentBlock.size() % 2 != 0) {
-                stream.readByte();
+    // Fast path for runs of short literals
+    if (auto tree = this->currentBlock.mainTree(); tree && !tree->m_multiLiterals.empty()) {
+        uint8_t literals[3];
+        size_t max = std::min<size_t>(state.outputSize - state.decodedLen, this->currentBlock.remaining());
+        size_t count = tree->decodeLiterals(stream, literals, max);
+
+        if (count != 0) {
+            this->flushPendingMatch(state);
+
+            for (size_t i = 0; i < count; i++) {
+                if constexpr (Record) {
+                    if (!state.tokens->pushLiteral(literals[i])) {
+                        return ErrorCode::OutOfMemory;
+                    }
+                } else {
+                    this->window.push(literals[i]);
+                }
             }
 
-            this->currentBlock = this->readBlock(stream, lzxd::readBlockHeader(stream));
-            LZXD_ASSERT(currentBlock.remaining() != 0);
+            state.decodedLen += count;
+            this->currentBlock.remaining() -= (uint32_t) count;
+            return ErrorCode::Ok;
         }
+    }
+
+    auto decoded = this->currentBlock.decodeElement(stream, this->r0, this->r1, this->r2);
+    size_t advance = 0;
 
-        auto decoded = this->currentBlock.decodeElement(stream, this->r0, this->r1, this->r2);
-        size_t advance = 0;
+    // A far match held back by the previous step can be executed now that this token is decoded,
+    // decoding it gave its source the time to arrive in cache.
+    this->flushPendingMatch(state);
 
-        if (std::holds_alternative<detail::DecodedSingle>(decoded)) {
-            auto value = std::get<detail::DecodedSingle>(decoded).value;
+    if (std::holds_alternative<detail::DecodedSingle>(decoded)) {
+        auto value = std::get<detail::DecodedSingle>(decoded).value;
+        if constexpr (Record) {
+            if (!state.tokens->pushLiteral(value)) {
+                return ErrorCode::OutOfMemory;
+            }
+        } else {
             this->window.push(value);
-            advance = 1;
-        } else if (std::holds_alternative<detail::DecodedMatch>(decoded)) {
-            auto match = std::get<detail::DecodedMatch>(decoded);
+        }
+        advance = 1;
+    } else if (std::holds_alternative<detail::DecodedMatch>(decoded)) {
+        auto match = std::get<detail::DecodedMatch>(decoded);
+
+        if (match.length == 0) {
+            return ErrorCode::InvalidMatch;
+        }
+
+        // Also keeps a hostile stream from reading what a previous stream left in the window after `reset`
+        if (match.offset > std::min(this->chunkOffset + state.decodedLen, this->windowSize - 3)) {
+            return ErrorCode::MatchOutOfBounds;
+        }
+
+        if constexpr (Record) {
+            if (!state.tokens->pushMatch(match.offset, match.length)) {
+                return ErrorCode::OutOfMemory;
+            }
+        } else if (match.offset >= this->prefetchMinOffset) {
+            this->window.prefetchFromSelf(match.offset, match.length);
+            state.pendingMatch = match;
+        } else {
+            LZXD_PROFILE_PHASE(this->profiler, Phase::Matches);
             this->window.copyFromSelf(match.offset, match.length);
-            advance = match.length;
+        }
+
+        advance = match.length;
+    } else {
+        auto read = std::get<detail::DecodedRead>(decoded).value;
+        // read up to the end of chunk, to allow for larger blocks
+        auto length = std::min(read, state.outputSize - state.decodedLen);
+
+        LZXD_PROFILE_PHASE(this->profiler, Phase::Uncompressed);
+        if constexpr (Record) {
+            auto* literals = state.tokens->appendLiterals(length);
+            if (!literals) {
+                return ErrorCode::OutOfMemory;
+            }
+            stream.readBytesInto(literals, length);
         } else {
-            auto read = std::get<detail::DecodedRead>(decoded).value;
-            // read up to the end of chunk, to allow for larger blocks
-            auto length = std::min(read, stream.remainingBytes());
-            this->window.copyFromBitstream(stream, read);
-            advance = read;
+            this->window.copyFromBitstream(stream, length);
         }
+        advance = length;
+    }
+
+    // Only a match can run past the end of its block, literals and reads always fit
+    if (advance > this->currentBlock.remaining() || advance > state.outputSize - state.decodedLen) {
+        state.pendingMatch.reset();
+        return ErrorCode::InvalidMatch;
+    }
+
+    state.decodedLen += advance;
+    this->currentBlock.remaining() -= (uint32_t) advance;
+    return ErrorCode::Ok;
+}
+
+namespace detail {
 
-        LZXD_ASSERT(advance != 0);
-        decodedLen += advance;
+// A stream of `decompressInterleaved` with its bit buffer, tables, window and repeated offsets copied
+// into locals, so that the loop over a few of them keeps them in registers rather than reloading them
+// from each decoder on every token. Only tokens that cannot cross the end of the block, the chunk or
+// the input, and whose codes fit the lookup tables, are decoded this way. Anything else goes through
+// `decodeStep` with the state written back to the decoder, which is rare enough not to matter.
+struct InterleavedLane {
+    // Input a token may read past its start: 16 + 16 bits of codes, 17 bits of offset and refills
+    static constexpr size_t INPUT_MARGIN = 16;
 
-        if (advance > this->currentBlock.remaining()) {
-            throw LzxdError("decompressChunkInto: advance is larger than remaining");
+    Decoder* decoder;
+    Decoder::ChunkState* state;
+    bool loaded = false;
+    bool bailed = false;
+
+    const uint8_t* next;
+    uint64_t bits;
+    uint32_t count;
+    const uint8_t* end; // last start of a token with `INPUT_MARGIN` bytes after it
+
+    const uint16_t* mainCodes;
+    const uint8_t* mainLengths;
+    uint32_t mainBits;
+    const uint16_t* lengthCodes; // null if the block has no length tree
+    const uint8_t* lengthLengths;
+    uint32_t lengthBits;
+    const uint16_t* alignedCodes; // null in verbatim blocks
+    const uint8_t* alignedLengths;
+    uint32_t alignedBits;
+
+    uint8_t* window;
+    size_t mask;
+    size_t position;
+    uint32_t r0, r1, r2;
+
+    size_t left; // bytes before the end of the block or of the chunk, whichever comes first
+    size_t done; // bytes decoded since the lane was loaded
+    size_t decoded; // bytes of the stream decoded when the lane was loaded
+    size_t maxOffset;
+
+    bool running() const {
+        return state->decodedLen != state->outputSize;
+    }
+
+    bool fast() const {
+        return loaded && left >= MAX_MATCH_LENGTH && next <= end;
+    }
+
+    // Takes the state of the decoder if the next token can be decoded here
+    void load() {
+        auto& block = decoder->currentBlock;
+        loaded = false;
+        bailed = false;
+
+        auto type = block.type();
+        left = std::min<size_t>(block.remaining(), state->outputSize - state->decodedLen);
+        if ((type != BlockType::Verbatim && type != BlockType::Aligned) || left < MAX_MATCH_LENGTH
+            || state->stream.remainingBytes() < INPUT_MARGIN) {
+            return;
         }
 
-        this->currentBlock.remaining() -= (uint32_t) advance;
+        // Matches held back for prefetching must land in the window first
+        decoder->flushPendingMatch(*state);
+
+        auto cursor = state->stream.cursor();
+        next = cursor.next;
+        bits = cursor.bits;
+        count = cursor.count;
+        end = state->stream.data().data() + state->stream.size() - INPUT_MARGIN;
+
+        auto* main = block.mainTree();
+        mainCodes = main->m_huffmanCodes.data();
+        mainLengths = main->m_lengths.data();
+        mainBits = main->m_tableBits;
+
+        auto* length = block.lengthTree();
+        lengthCodes = length ? length->m_huffmanCodes.data() : nullptr;
+        lengthLengths = length ? length->m_lengths.data() : nullptr;
+        lengthBits = length ? length->m_tableBits : 0;
+
+        auto* aligned = block.alignedOffsetTree();
+        alignedCodes = aligned ? aligned->m_huffmanCodes.data() : nullptr;
+        alignedLengths = aligned ? aligned->m_lengths.data() : nullptr;
+        alignedBits = aligned ? aligned->m_tableBits : 0;
+
+        window = decoder->window.data.data();
+        mask = decoder->window.data.size() - 1;
+        position = decoder->window.position;
+        r0 = decoder->r0;
+        r1 = decoder->r1;
+        r2 = decoder->r2;
+        done = 0;
+        decoded = decoder->chunkOffset + state->decodedLen;
+        maxOffset = decoder->windowSize - 3;
+        loaded = true;
     }
 
-    auto chunkOffset = this->chunkOffset;
-    this->chunkOffset += decodedLen;
+    // Writes the state back to the decoder
+    void store() {
+        if (!loaded) {
+            return;
+        }
 
-    auto viewStart = this->window.pastView(decodedLen);
+        state->stream.setCursor({next, bits, count});
+        decoder->window.position = position;
+        decoder->r0 = r0;
+        decoder->r1 = r1;
+        decoder->r2 = r2;
+        decoder->currentBlock.remaining() -= static_cast<uint32_t>(done);
+        state->decodedLen += done;
+        loaded = false;
+    }
 
-    // E8 fixups are disabled after 1GB of input data, or if the chunk size is too small.
-    if (e8Translator && chunkOffset < 0x40000000 && decodedLen > 10) {
-        // TODO
-        throw LzxdError("E8 translation not implemented!");
+    LZXD_ALWAYS_INLINE void refill() {
+        while (count <= 48) {
+            uint16_t word;
+            std::memcpy(&word, next, sizeof(uint16_t));
+#ifdef LZXD_BIG_ENDIAN
+            word = detail::byteswap(word);
+#endif
+            bits |= uint64_t(word) << (48 - count);
+            next += sizeof(uint16_t);
+            count += 16;
+        }
+    }
+
+    // Up to 32 bits, 0 bits included
+    LZXD_ALWAYS_INLINE uint32_t peek(uint32_t n) const {
+        return static_cast<uint32_t>((bits >> 1) >> (63 - n));
+    }
+
+    LZXD_ALWAYS_INLINE void consume(uint32_t n) {
+        bits <<= n;
+        count -= n;
+    }
+
+    // Same as `Tree::decodeElement`, returns `Tree::LONG_CODE` without consuming anything for long codes
+    LZXD_ALWAYS_INLINE uint16_t decode(const uint16_t* codes, const uint8_t* lengths, uint32_t tableBits) {
+        auto code = codes[this->peek(tableBits)];
+        if (code != Tree::LONG_CODE) [[likely]] {
+            this->consume(lengths[code]);
+        }
+
+        return code;
+    }
+
+    // Decodes one token. Returns whether the next one can be decoded here as well.
+    LZXD_ALWAYS_INLINE bool step() {
+        auto start = next;
+        auto startBits = bits;
+        auto startCount = count;
+
+        // Leaves the token to `decodeStep`
+        auto bail = [&] {
+            next = start;
+            bits = startBits;
+            count = startCount;
+            bailed = true;
+            return false;
+        };
+
+        this->refill();
+        auto mainElement = this->decode(mainCodes, mainLengths, mainBits);
+        if (mainElement == Tree::LONG_CODE) [[unlikely]] {
+            return bail();
+        }
+
+        if (mainElement <= 255) {
+            window[position] = static_cast<uint8_t>(mainElement);
+            position = (position + 1) & mask;
+            left--;
+            done++;
+            return this->fast();
+        }
+
+        uint32_t lengthHeader = (mainElement - 256) & 7;
+        size_t length = lengthHeader + 2;
+        if (lengthHeader == 7) {
+            if (!lengthCodes) [[unlikely]] {
+                return bail();
+            }
+
+            auto footer = this->decode(lengthCodes, lengthLengths, lengthBits);
+            if (footer == Tree::LONG_CODE) [[unlikely]] {
+                return bail();
+            }
+
+            length = footer + 7 + 2;
+        }
+
+        uint32_t positionSlot = (mainElement - 256) >> 3;
+        uint32_t offset;
+        uint32_t startR0 = r0, startR1 = r1, startR2 = r2;
+
+        if (positionSlot == 0) {
+            offset = r0;
+        } else if (positionSlot == 1) {
+            offset = r1;
+            std::swap(r1, r0);
+        } else if (positionSlot == 2) {
+            offset = r2;
+            std::swap(r2, r0);
+        } else {
+            this->refill();
+            uint32_t offsetBits = FOOTER_BITS[positionSlot];
+            uint32_t formatted;
+
+            if (alignedCodes && offsetBits >= 3) {
+                uint32_t verbatimBits = this->peek(offsetBits - 3);
+                this->consume(offsetBits - 3);
+
+                auto alignedElement = this->decode(alignedCodes, alignedLengths, alignedBits);
+                if (alignedElement == Tree::LONG_CODE) [[unlikely]] {
+                    return bail();
+                }
+
+                formatted = BASE_POSITION[positionSlot] + (verbatimBits << 3) + alignedElement;
+            } else {
+                uint32_t verbatimBits = this->peek(offsetBits);
+                this->consume(offsetBits);
+                formatted = BASE_POSITION[positionSlot] + verbatimBits;
+            }
+
+            offset = formatted - 2;
+            r2 = r1;
+            r1 = r0;
+            r0 = offset;
+        }
+
+        // `decodeStep` reports the error
+        if (offset > decoded + done || offset > maxOffset) [[unlikely]] {
+            r0 = startR0;
+            r1 = startR1;
+            r2 = startR2;
+            return bail();
+        }
+
+        // Same as `Window::copyFromSelf`
+        if (offset <= position && length <= offset && position + length <= mask) {
+            copyBytes(window + position, window + position - offset, length);
+        } else {
+            for (size_t i = 0; i < length; i++) {
+                window[(position + i) & mask] = window[(mask + 1 + position + i - offset) & mask];
+            }
+        }
+
+        position = (position + length) & mask;
+        left -= length;
+        done += length;
+        return this->fast();
+    }
+};
+
+// Decodes a token of every lane in turn until one of them has to leave the loop. The lanes are
+// copied into locals so that nothing aliases them.
+template <size_t N>
+LZXD_ALWAYS_INLINE void runLanes(InterleavedLane* lanes) {
+    InterleavedLane local[N];
+    std::copy(lanes, lanes + N, local);
+
+    bool fast = true;
+    while (fast) {
+        [&]<size_t... I>(std::index_sequence<I...>) {
+            fast = (local[I].step() & ...);
+        }(std::make_index_sequence<N>{});
     }
 
+    std::copy(local, local + N, lanes);
+}
+
+} // namespace detail
+
+LZXD_ALWAYS_INLINE void Decoder::interleaveSteps(InterleavedChunk* chunks, std::optional<ChunkState>* states, size_t count) {
+    detail::InterleavedLane lanes[4];
+    InterleavedChunk* owners[4];
+    size_t active = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (chunks[i].error == ErrorCode::Ok) {
+            lanes[active].decoder = chunks[i].decoder;
+            lanes[active].state = &*states[i];
+            owners[active] = &chunks[i];
+            active++;
+        }
+    }
+
+    while (active != 0) {
+        // Lanes that cannot take the fast path step through `decodeStep` until they can or are done.
+        // A lane that failed or finished is replaced by the last one.
+        for (size_t i = 0; i < active;) {
+            auto& lane = lanes[i];
+            auto& error = owners[i]->error;
+
+            // A lane that bailed out left its next token to `decodeStep`
+            bool step = lane.bailed;
+            lane.store();
+
+            while (error == ErrorCode::Ok && lane.running()) {
+                if (!step) {
+                    lane.load();
+                    if (lane.fast()) {
+                        break;
+                    }
+                }
+
+                step = false;
+                error = lane.decoder->decodeStep(*lane.state);
+            }
+
+            if (error != ErrorCode::Ok || !lane.running()) {
+                active--;
+                lanes[i] = lanes[active];
+                owners[i] = owners[active];
+            } else {
+                i++;
+            }
+        }
+
+        switch (active) {
+            case 4: detail::runLanes<4>(lanes); break;
+            case 3: detail::runLanes<3>(lanes); break;
+            case 2: detail::runLanes<2>(lanes); break;
+            case 1: detail::runLanes<1>(lanes); break;
+            default: break;
+        }
+    }
+}
+
+void Decoder::interleaveLoopScalar(InterleavedChunk* chunks, std::optional<ChunkState>* states, size_t count) {
+    interleaveSteps(chunks, states, count);
+}
+
+#if LZXD_X86_DISPATCH
+[[gnu::target("avx2,bmi,bmi2")]]
+#endif
+void Decoder::interleaveLoopAvx2(InterleavedChunk* chunks, std::optional<ChunkState>* states, size_t count) {
+    interleaveSteps(chunks, states, count);
+}
+
+LZXD_HOT_INLINE void Decoder::flushPendingMatch(ChunkState& state) {
+    if (state.pendingMatch) {
+        LZXD_PROFILE_PHASE(this->profiler, Phase::Matches);
+        this->window.copyFromSelf(state.pendingMatch->offset, state.pendingMatch->length);
+        state.pendingMatch.reset();
+    }
+}
+
+void Decoder::scatterOutput(std::span<const OutputSegment> segments, size_t len) {
+    size_t back = len;
+
+    for (auto& segment : segments) {
+        if (back == 0) {
+            break;
+        }
+
+        // Empty segments may have a null base, which `memcpy` must not be given
+        if (segment.length == 0) {
+            continue;
+        }
+
+        auto part = std::min(segment.length, back);
+        this->window.copyPastInto(static_cast<uint8_t*>(segment.base), back, part);
+        back -= part;
+    }
+}
+
+Result<size_t> Decoder::finishChunk(ChunkState& state) {
+    this->flushPendingMatch(state);
+    LZXD_PROFILE(this->profiler.endBlock());
+
+#if defined(LZXD_ENABLE_PROFILING)
+    if (this->currentBlock.remaining() == 0 && this->currentBlock.size() != 0) {
+        LZXD_PROBE(block_end, static_cast<int>(this->currentBlock.type()), this->currentBlock.size());
+    }
+#endif
+
+    // Bits past the end of the chunk were read as zeros, so whatever was decoded from them is garbage
+    if (state.stream.overflowed()) {
+        return ErrorCode::UnexpectedEof;
+    }
+
+    size_t decodedLen = state.decodedLen;
+    this->chunkOffset += decodedLen;
     decodedChunks++;
 
-    std::memcpy(output, viewStart, decodedLen);
+    if (state.tokens) {
+        // Recorded, the output is built by the caller
+    } else if (state.output) {
+        LZXD_PROFILE_PHASE(this->profiler, Phase::Output);
+        this->window.copyPastInto(state.output, decodedLen);
+    } else if (!state.segments.empty()) {
+        LZXD_PROFILE_PHASE(this->profiler, Phase::Output);
+        this->scatterOutput(state.segments, decodedLen);
+    }
 
+    LZXD_PROFILE(this->profiler.endChunk(decodedLen));
     return decodedLen;
 }
 
-Block Decoder::readBlock(BitStream& stream, const BlockHeader& header) {
+ErrorCode Decoder::readBlock(BitStream& stream, const BlockHeader& header, Block& out) {
     if (header.type == BlockType::Invalid || header.size == 0) {
-        throw lzxd::LzxdError("decompressChunkInto: invalid block header");
+        return ErrorCode::InvalidBlockHeader;
     }
 
+    // Building the multi-literal table costs about as much as decoding a few thousand literals
+    bool multiLiterals = header.size >= detail::MULTI_LITERAL_MIN_BLOCK_SIZE;
+
     switch (header.type) {
         case BlockType::Uncompressed: {
             stream.align(); // Align to 16-bit boundary
@@ -142,53 +1000,97 @@ Block Decoder::readBlock(BitStream& stream, const BlockHeader& header) {
             uint32_t r1 = stream.readU32le();
             uint32_t r2 = stream.readU32le();
 
-            return UncompressedBlock {
+            out = UncompressedBlock {
                 BaseBlock {header.size, header.size},
                 r0, r1, r2
             };
         } break;
 
         case BlockType::Verbatim: {
-            this->readMainAndLengthTrees(stream);
+            if (auto err = this->readMainAndLengthTrees(stream); err != ErrorCode::Ok) {
+                return err;
+            }
 
-            return VerbatimBlock {
+            auto mainTree = this->buildTree(this->mainTree, this->mainTreeInstance, this->sharedMainTree, multiLiterals);
+            if (!mainTree) {
+                return ErrorCode::InvalidTree;
+            }
+
+            out = VerbatimBlock {
                 BaseBlock {header.size, header.size},
-                this->mainTree.createInstance().value(),
-                this->lengthTree.createInstance()
+                mainTree,
+                this->buildTree(this->lengthTree, this->lengthTreeInstance, this->sharedLengthTree, false)
             };
         } break;
 
         case BlockType::Aligned: {
             // create the aligned offset tree
-            std::vector<uint8_t> lengths(8);
+            this->alignedOffsetTree.m_lengths.resize(8);
             for (size_t i = 0; i < 8; i++) {
-                lengths[i] = stream.readBits<uint8_t>(3);
+                this->alignedOffsetTree.m_lengths[i] = stream.readBits<uint8_t>(3);
+            }
+
+            if (!this->alignedOffsetTree.build()) {
+                return ErrorCode::InvalidTree;
             }
 
-            Tree alignedOffsetTree = Tree::fromPathLengths(std::move(lengths));
+            if (auto err = this->readMainAndLengthTrees(stream); err != ErrorCode::Ok) {
+                return err;
+            }
 
-            this->readMainAndLengthTrees(stream);
+            auto mainTree = this->buildTree(this->mainTree, this->mainTreeInstance, this->sharedMainTree, multiLiterals);
+            if (!mainTree) {
+                return ErrorCode::InvalidTree;
+            }
 
-            return AlignedOffsetBlock {
+            out = AlignedOffsetBlock {
                 BaseBlock {header.size, header.size},
-                this->mainTree.createInstance().value(),
-                this->lengthTree.createInstance(),
-                alignedOffsetTree
+                mainTree,
+                this->buildTree(this->lengthTree, this->lengthTreeInstance, this->sharedLengthTree, false),
+                &this->alignedOffsetTree
             };
         } break;
 
         case BlockType::Invalid:
-        default: {
-            // unreachable
-            LZXD_ASSERT(false);
-        } break;
+        default:
+            return ErrorCode::InvalidBlockHeader;
+    }
+
+    return ErrorCode::Ok;
+}
+
+const Tree* Decoder::buildTree(const CanonicalTree& tree, Tree& instance, std::shared_ptr<const Tree>& shared, bool multiLiterals) {
+    if (this->treeCache) {
+        shared = this->treeCache->get(tree.m_lengths, multiLiterals);
+        return shared.get();
+    }
+
+    shared.reset();
+    if (!tree.buildInstance(instance)) {
+        return nullptr;
+    }
+
+    if (multiLiterals) {
+        instance.buildMultiLiterals();
     }
+
+    return &instance;
 }
 
-void Decoder::readMainAndLengthTrees(BitStream& stream) {
-    this->mainTree.updateRangeWithPretree(stream, 0, 256);
-    this->mainTree.updateRangeWithPretree(stream, 256, 256 + detail::positionSlotsFor(this->windowSize) * 8);
-    this->lengthTree.updateRangeWithPretree(stream, 0, 249);
+ErrorCode Decoder::readMainAndLengthTrees(BitStream& stream) {
+    size_t mainSize = 256 + detail::positionSlotsFor(this->windowSize) * 8;
+
+    for (auto [tree, start, end] : {
+        std::tuple{&this->mainTree, size_t(0), size_t(256)},
+        std::tuple{&this->mainTree, size_t(256), mainSize},
+        std::tuple{&this->lengthTree, size_t(0), size_t(249)},
+    }) {
+        if (auto err = tree->updateRangeWithPretree(stream, start, end, this->pretree); err != ErrorCode::Ok) {
+            return err;
+        }
+    }
+
+    return ErrorCode::Ok;
 }
 
 void Decoder::firstChunk(BitStream& stream) {
@@ -196,17 +1098,28 @@ void Decoder::firstChunk(BitStream& stream) {
     bool e8Translation = stream.readBit();
 
     if (e8Translation) {
-        throw lzxd::LzxdError("E8 translation not implemented!");
-        // this->e8Translator = detail::E8Translator{std::bit_cast<int32_t>(stream.readBits(32))};
+        // Translation itself is not implemented yet, but streams using it can still be validated or skipped
+        this->e8Translator = detail::E8Translator{std::bit_cast<int32_t>(stream.readBits(32))};
     }
 }
 
 void Decoder::reset() {
-    auto wsize = this->windowSize;
+    // Only the decoding state is cleared, the buffers are kept. Leftovers in the window cannot be
+    // read, as matches reaching before the start of the stream fail with `MatchOutOfBounds`.
+    this->decodedChunks = 0;
+    this->chunkOffset = 0;
+    this->r0 = this->r1 = this->r2 = 1;
+    this->window.position = 0;
+
+    std::fill(this->mainTree.m_lengths.begin(), this->mainTree.m_lengths.end(), 0);
+    std::fill(this->lengthTree.m_lengths.begin(), this->lengthTree.m_lengths.end(), 0);
 
-    this->~Decoder();
+    this->currentBlock = UncompressedBlock {
+        BaseBlock {0, 0},
+        1, 1, 1
+    };
 
-    new (this) Decoder(wsize);
+    this->e8Translator.reset();
 }
 
 } // namespace lzxd
\ No newline at end of file
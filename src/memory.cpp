@@ -0,0 +1,81 @@
+#include <lzxd/memory.hpp>
+#include <lzxd/error.hpp>
+#include <cstdlib>
+#include <new>
+#include <cstdint>
+
+#ifdef __linux__
+# include <sys/mman.h>
+#endif
+
+namespace lzxd {
+
+#ifdef __linux__
+static size_t hugePageRoundUp(size_t bytes) {
+    return (bytes + HugePageResource::HUGE_PAGE_SIZE - 1) & ~(HugePageResource::HUGE_PAGE_SIZE - 1);
+}
+#endif
+
+void* HugePageResource::do_allocate(size_t bytes, size_t alignment) {
+#ifdef __linux__
+    if (bytes >= HUGE_PAGE_SIZE && alignment <= HUGE_PAGE_SIZE) {
+        size_t size = hugePageRoundUp(bytes);
+
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            return ptr;
+        }
+
+        // No explicit huge pages reserved, map an extra huge page so that the region can be aligned,
+        // which is required for the kernel to back it with transparent huge pages.
+        auto* raw = static_cast<uint8_t*>(mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (raw == MAP_FAILED) {
+#if LZXD_EXCEPTIONS
+            throw std::bad_alloc();
+#else
+            std::abort();
+#endif
+        }
+
+        auto* aligned = reinterpret_cast<uint8_t*>(hugePageRoundUp(reinterpret_cast<uintptr_t>(raw)));
+        size_t head = aligned - raw;
+        size_t tail = HUGE_PAGE_SIZE - head;
+
+        if (head != 0) {
+            munmap(raw, head);
+        }
+
+        if (tail != 0) {
+            munmap(aligned + size, tail);
+        }
+
+        madvise(aligned, size, MADV_HUGEPAGE);
+        return aligned;
+    }
+#endif
+
+    return m_upstream->allocate(bytes, alignment);
+}
+
+void HugePageResource::do_deallocate(void* ptr, size_t bytes, size_t alignment) {
+#ifdef __linux__
+    if (bytes >= HUGE_PAGE_SIZE && alignment <= HUGE_PAGE_SIZE) {
+        munmap(ptr, hugePageRoundUp(bytes));
+        return;
+    }
+#endif
+
+    m_upstream->deallocate(ptr, bytes, alignment);
+}
+
+bool HugePageResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    auto* res = dynamic_cast<const HugePageResource*>(&other);
+    return res && res->m_upstream == m_upstream;
+}
+
+std::pmr::memory_resource* hugePageResource() {
+    static HugePageResource resource;
+    return &resource;
+}
+
+} // namespace lzxd
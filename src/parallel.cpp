@@ -0,0 +1,361 @@
+#include <lzxd/parallel.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lzxd {
+
+template <typename Chunks>
+static ErrorCode checkChunkTable(const Chunks& chunks) {
+    if (detail::positionSlotsFor(chunks.windowSize) == 0) {
+        return ErrorCode::InvalidWindowSize;
+    }
+
+    if (chunks.chunkSize == 0 || chunks.chunkSize > chunks.windowSize) {
+        return ErrorCode::ChunkTooLarge;
+    }
+
+    size_t count = (chunks.outputSize + chunks.chunkSize - 1) / chunks.chunkSize;
+    if (chunks.offsets.size() != count + 1) {
+        return ErrorCode::InvalidChunkTable;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (chunks.offsets[i] > chunks.offsets[i + 1]) {
+            return ErrorCode::InvalidChunkTable;
+        }
+    }
+
+    return ErrorCode::Ok;
+}
+
+ErrorCode decompressChunksParallel(const IndependentChunks& chunks, uint8_t* output, unsigned threads, std::pmr::memory_resource* resource) {
+    if (auto err = checkChunkTable(chunks); err != ErrorCode::Ok) {
+        return err;
+    }
+
+    size_t count = chunks.offsets.size() - 1;
+    if (count == 0) {
+        return ErrorCode::Ok;
+    }
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+
+    // Chunks are handed out one at a time, they are small enough that this balances well
+    // while keeping each thread's output writes contiguous.
+    std::atomic<size_t> next = 0;
+    std::atomic<ErrorCode> error = ErrorCode::Ok;
+
+    auto worker = [&] {
+        Decoder decoder(chunks.windowSize, resource);
+        decoder.setTreeCache(chunks.treeCache);
+
+        while (error.load(std::memory_order_relaxed) == ErrorCode::Ok) {
+            size_t i = next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= count) {
+                break;
+            }
+
+            size_t start = i * chunks.chunkSize;
+            size_t outputSize = std::min(chunks.chunkSize, chunks.outputSize - start);
+
+            decoder.reset();
+            auto result = decoder.tryDecompressChunkInto(
+                chunks.data + chunks.offsets[i],
+                chunks.offsets[i + 1] - chunks.offsets[i],
+                output + start,
+                outputSize
+            );
+
+            if (result.ok() && result.value() != outputSize) {
+                result = ErrorCode::UnexpectedEof;
+            }
+
+            if (!result) {
+                auto expected = ErrorCode::Ok;
+                error.compare_exchange_strong(expected, result.error());
+            }
+        }
+    };
+
+    // The calling thread does its share of the work
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (unsigned i = 1; i < threads; i++) {
+        pool.emplace_back(worker);
+    }
+
+    worker();
+
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    return error.load();
+}
+
+static ErrorCode decompressFramedSerial(const FramedChunks& chunks, uint8_t* output, std::pmr::memory_resource* resource) {
+    Decoder decoder(chunks.windowSize, resource);
+
+    for (size_t i = 0; i + 1 < chunks.offsets.size(); i++) {
+        size_t start = i * chunks.chunkSize;
+        size_t outputSize = std::min(chunks.chunkSize, chunks.outputSize - start);
+
+        auto result = decoder.tryDecompressChunkInto(
+            chunks.data + chunks.offsets[i],
+            chunks.offsets[i + 1] - chunks.offsets[i],
+            output + start,
+            outputSize
+        );
+
+        if (!result) {
+            return result.error();
+        }
+
+        if (result.value() != outputSize) {
+            return ErrorCode::UnexpectedEof;
+        }
+    }
+
+    return ErrorCode::Ok;
+}
+
+namespace detail {
+
+// A match that could not be executed when its chunk was built, as it reads bytes that were not final
+struct DeferredMatch {
+    uint32_t pos; // within the chunk
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Copies a match within the output, byte by byte if it overlaps itself
+static void copyMatch(uint8_t* dst, size_t offset, size_t length) {
+    const uint8_t* src = dst - offset;
+
+    if (offset >= length) {
+        std::memcpy(dst, src, length);
+    } else {
+        for (size_t i = 0; i < length; i++) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+// Whether `[start, end)` overlaps one of the matches, which are sorted and do not overlap each other
+static bool readsDeferred(const std::vector<DeferredMatch>& deferred, size_t start, size_t end) {
+    auto it = std::upper_bound(deferred.begin(), deferred.end(), end, [](size_t pos, const DeferredMatch& match) {
+        return pos <= match.pos;
+    });
+
+    return it != deferred.begin() && std::prev(it)->pos + std::prev(it)->length > start;
+}
+
+// Writes a recorded chunk to `out`, except for the matches reading before the start of the chunk or
+// from such matches, which are added to `deferred` in order
+static void buildChunk(const detail::ChunkTokens& tokens, uint8_t* out, std::vector<DeferredMatch>& deferred) {
+    deferred.clear();
+
+    size_t pos = 0;
+    const uint8_t* literal = tokens.literals.data();
+
+    // The literals may be empty and without storage, which `memcpy` does not accept even for 0 bytes
+    for (auto& seq : tokens.sequences) {
+        if (seq.literals != 0) {
+            std::memcpy(out + pos, literal, seq.literals);
+            pos += seq.literals;
+            literal += seq.literals;
+        }
+
+        // An overlapping match reads its own bytes too, which are written in order
+        if (seq.offset > pos || readsDeferred(deferred, pos - seq.offset, pos - seq.offset + std::min(seq.offset, seq.length))) {
+            deferred.push_back({static_cast<uint32_t>(pos), seq.offset, seq.length});
+        } else {
+            copyMatch(out + pos, seq.offset, seq.length);
+        }
+
+        pos += seq.length;
+    }
+
+    if (tokens.trailingLiterals != 0) {
+        std::memcpy(out + pos, literal, tokens.trailingLiterals);
+    }
+}
+
+// Executes the deferred matches of the chunk at `out`, every byte before it must be final
+static void resolveChunk(const std::vector<DeferredMatch>& deferred, uint8_t* out) {
+    for (auto& match : deferred) {
+        copyMatch(out + match.pos, match.offset, match.length);
+    }
+}
+
+// Building a chunk takes about a quarter of the time it takes to record it, more workers than
+// this just wait for the recording thread.
+constexpr unsigned MAX_FRAMED_WORKERS = 3;
+// Each slot keeps the tokens of a chunk, which are about as large as its output
+constexpr size_t FRAMED_SLOTS = 8;
+
+// The calling thread records chunks into a ring of slots, workers write them to the output in any
+// order, and whichever worker completes the next chunk in order resolves it and frees its slot.
+// Only the deferred matches are resolved in order, everything else is copied by the workers.
+class FramedPipeline {
+public:
+    FramedPipeline(const FramedChunks& chunks, uint8_t* output)
+        : m_chunks(chunks), m_output(output), m_count(chunks.offsets.size() - 1), m_slots(FRAMED_SLOTS) {}
+
+    ErrorCode run(std::pmr::memory_resource* resource, unsigned workers) {
+        std::vector<std::thread> pool;
+        pool.reserve(workers);
+        for (unsigned i = 0; i < workers; i++) {
+            pool.emplace_back([this] { this->work(); });
+        }
+
+        auto error = this->record(resource);
+
+        {
+            std::lock_guard lock(m_mutex);
+            m_finished = true;
+        }
+        m_workAvailable.notify_all();
+
+        for (auto& thread : pool) {
+            thread.join();
+        }
+
+        return error;
+    }
+
+private:
+    struct Slot {
+        detail::ChunkTokens tokens;
+        std::vector<DeferredMatch> deferred;
+        bool built = false;
+    };
+
+    const FramedChunks& m_chunks;
+    uint8_t* m_output;
+    size_t m_count;
+    std::vector<Slot> m_slots;
+
+    std::mutex m_mutex;
+    std::condition_variable m_workAvailable, m_slotFreed;
+    std::deque<size_t> m_queue;
+    size_t m_resolved = 0;
+    bool m_resolving = false;
+    bool m_finished = false;
+
+    Slot& slotFor(size_t index) {
+        return m_slots[index % m_slots.size()];
+    }
+
+    size_t outputSizeOf(size_t index) const {
+        return std::min(m_chunks.chunkSize, m_chunks.outputSize - index * m_chunks.chunkSize);
+    }
+
+    ErrorCode record(std::pmr::memory_resource* resource) {
+        Decoder decoder(m_chunks.windowSize, resource);
+
+        for (size_t i = 0; i < m_count; i++) {
+            {
+                std::unique_lock lock(m_mutex);
+                m_slotFreed.wait(lock, [&] { return i < m_resolved + m_slots.size(); });
+            }
+
+            auto& slot = this->slotFor(i);
+            auto result = decoder.recordChunk(
+                m_chunks.data + m_chunks.offsets[i],
+                m_chunks.offsets[i + 1] - m_chunks.offsets[i],
+                this->outputSizeOf(i),
+                slot.tokens
+            );
+
+            if (!result) {
+                return result.error();
+            }
+
+            if (result.value() != this->outputSizeOf(i)) {
+                return ErrorCode::UnexpectedEof;
+            }
+
+            {
+                std::lock_guard lock(m_mutex);
+                m_queue.push_back(i);
+            }
+            m_workAvailable.notify_one();
+        }
+
+        return ErrorCode::Ok;
+    }
+
+    void work() {
+        std::unique_lock lock(m_mutex);
+
+        while (true) {
+            m_workAvailable.wait(lock, [&] { return !m_queue.empty() || m_finished; });
+            if (m_queue.empty()) {
+                return;
+            }
+
+            size_t index = m_queue.front();
+            m_queue.pop_front();
+            lock.unlock();
+
+            auto& slot = this->slotFor(index);
+            buildChunk(slot.tokens, m_output + index * m_chunks.chunkSize, slot.deferred);
+
+            lock.lock();
+            slot.built = true;
+
+            // Resolve every chunk that is ready in order, unless another worker already does
+            if (m_resolving) {
+                continue;
+            }
+
+            m_resolving = true;
+            while (m_resolved < m_count && this->slotFor(m_resolved).built) {
+                auto& next = this->slotFor(m_resolved);
+                lock.unlock();
+
+                resolveChunk(next.deferred, m_output + m_resolved * m_chunks.chunkSize);
+
+                lock.lock();
+                next.built = false;
+                m_resolved++;
+                m_slotFreed.notify_one();
+            }
+            m_resolving = false;
+        }
+    }
+};
+
+} // namespace detail
+
+ErrorCode decompressFramedParallel(const FramedChunks& chunks, uint8_t* output, unsigned threads, std::pmr::memory_resource* resource) {
+    if (auto err = checkChunkTable(chunks); err != ErrorCode::Ok) {
+        return err;
+    }
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    if (threads == 1) {
+        return decompressFramedSerial(chunks, output, resource);
+    }
+
+    // Recording fails on the same streams as the serial decoder, with the same error
+    unsigned workers = std::min(threads - 1, detail::MAX_FRAMED_WORKERS);
+    detail::FramedPipeline pipeline(chunks, output);
+    return pipeline.run(resource, workers);
+}
+
+} // namespace lzxd
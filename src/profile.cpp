@@ -0,0 +1,108 @@
+#include <lzxd/profile.hpp>
+#include <bit>
+
+namespace lzxd {
+
+const char* phaseName(Phase phase) {
+    switch (phase) {
+        case Phase::Trees: return "trees";
+        case Phase::Tokens: return "tokens";
+        case Phase::Matches: return "matches";
+        case Phase::Uncompressed: return "uncompressed";
+        case Phase::Output: return "output";
+        default: return "unknown";
+    }
+}
+
+void Profile::reset() {
+    // Keeps the capacity of the block list
+    auto blocks = std::move(this->lastChunk.blocks);
+    blocks.clear();
+
+    *this = Profile{};
+    this->lastChunk.blocks = std::move(blocks);
+}
+
+namespace detail {
+
+// Tokens are not timed directly, that would double the timer reads in the hottest loop.
+// They get whatever time the other phases do not account for.
+static void fillTokens(PhaseCycles& cycles, uint64_t total) {
+    uint64_t other = 0;
+    for (size_t i = 0; i < PHASE_COUNT; i++) {
+        if (i != static_cast<size_t>(Phase::Tokens)) {
+            other += cycles[i];
+        }
+    }
+
+    cycles[static_cast<size_t>(Phase::Tokens)] = total > other ? total - other : 0;
+}
+
+void Profiler::beginChunk(size_t index, [[maybe_unused]] size_t compressedSize) {
+    LZXD_PROBE(chunk_start, index, compressedSize);
+
+    auto& chunk = this->profile.lastChunk;
+    chunk.index = index;
+    chunk.size = 0;
+    chunk.totalCycles = 0;
+    chunk.cycles = {};
+    chunk.blocks.clear();
+
+    m_chunkStart = readCycles();
+    m_inBlock = false;
+}
+
+void Profiler::beginBlock(BlockType type, uint32_t size) {
+    auto now = readCycles();
+    this->endBlock(now);
+
+    LZXD_PROBE(block_start, static_cast<int>(type), size);
+
+    this->profile.lastChunk.blocks.push_back(BlockProfile{type, size});
+    m_blockStart = now;
+    m_inBlock = true;
+}
+
+void Profiler::endBlock() {
+    this->endBlock(readCycles());
+}
+
+void Profiler::add(Phase phase, uint64_t cycles) {
+    auto& chunk = this->profile.lastChunk;
+    chunk.cycles[static_cast<size_t>(phase)] += cycles;
+
+    if (m_inBlock) {
+        chunk.blocks.back().cycles[static_cast<size_t>(phase)] += cycles;
+    }
+}
+
+void Profiler::endBlock(uint64_t now) {
+    if (m_inBlock) {
+        fillTokens(this->profile.lastChunk.blocks.back().cycles, now - m_blockStart);
+        m_inBlock = false;
+    }
+}
+
+void Profiler::endChunk(size_t size) {
+    auto now = readCycles();
+    this->endBlock(now);
+
+    auto& chunk = this->profile.lastChunk;
+    chunk.size = size;
+    chunk.totalCycles = now - m_chunkStart;
+    fillTokens(chunk.cycles, chunk.totalCycles);
+
+    this->profile.chunks++;
+    for (size_t i = 0; i < PHASE_COUNT; i++) {
+        this->profile.cycles[i] += chunk.cycles[i];
+    }
+
+    size_t bucket = chunk.totalCycles == 0 ? 0 : std::bit_width(chunk.totalCycles) - 1;
+    this->profile.latencyHistogram[bucket]++;
+
+    LZXD_PROBE(chunk_end, chunk.index, size, chunk.totalCycles);
+}
+
+} // namespace detail
+
+} // namespace lzxd
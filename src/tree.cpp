@@ -3,67 +3,190 @@
 
 namespace lzxd {
 
-Tree Tree::fromPathLengths(std::vector<uint8_t> lengths) {
+Tree Tree::fromPathLengths(std::pmr::vector<uint8_t> lengths) {
     CanonicalTree ctree(std::move(lengths));
     return ctree.createInstance().value();
 }
 
-uint16_t Tree::decodeElement(BitStream& stream) const {
-    // Perform the inverse translation, peeking as many bits as our tree is…
-    uint32_t idx = stream.peekBits<uint32_t>(this->m_largestLength);
-    auto code = this->m_huffmanCodes[idx];
+void Tree::buildMultiLiterals() {
+    constexpr uint8_t K = MULTI_LITERAL_BITS;
 
-    // …and then advancing the stream by the length of the code
-    stream.readBits(this->m_lengths[code]);
+    // Probability of the next code being a literal short enough to leave room for another one
+    double shortLiterals = 0.0;
+    for (size_t code = 0; code < 256 && code < m_lengths.size(); code++) {
+        if (m_lengths[code] != 0 && m_lengths[code] <= K / 2) {
+            shortLiterals += 1.0 / (1 << m_lengths[code]);
+        }
+    }
+
+    if (shortLiterals < 0.5) {
+        m_multiLiterals.clear();
+        return;
+    }
+
+    // Finds the code at the start of `bits` (left-aligned in K bits), if it fits in `avail` bits
+    auto lookup = [&](uint32_t bits, uint8_t avail) -> std::optional<uint16_t> {
+        static_assert(TABLE_BITS <= K);
+        auto code = m_huffmanCodes[bits >> (K - m_tableBits)];
+        if (code > 255 || m_lengths[code] > avail) {
+            return std::nullopt;
+        }
+        return code;
+    };
+
+    m_multiLiterals.resize(1 << K);
+    for (uint32_t idx = 0; idx < m_multiLiterals.size(); idx++) {
+        MultiLiteral entry{0, 0, {0, 0, 0}};
+
+        while (entry.count < 3) {
+            auto code = lookup((idx << entry.bits) & ((1 << K) - 1), K - entry.bits);
+            if (!code) {
+                break;
+            }
+
+            entry.literals[entry.count++] = static_cast<uint8_t>(*code);
+            entry.bits += m_lengths[*code];
+        }
 
-    return code;
+        m_multiLiterals[idx] = entry;
+    }
 }
 
-std::optional<Tree> CanonicalTree::createInstance() const {
-    if (this->m_lengths.empty()) {
-        return std::nullopt;
+void Tree::reserve(size_t symbols, uint8_t maxLength, bool multiLiterals) {
+    m_lengths.reserve(symbols);
+    m_sortedSymbols.reserve(symbols);
+    m_huffmanCodes.reserve(size_t(1) << std::min(maxLength, TABLE_BITS));
+
+    if (multiLiterals) {
+        m_multiLiterals.reserve(size_t(1) << MULTI_LITERAL_BITS);
     }
+}
 
-    Tree tree;
-    tree.m_lengths = this->m_lengths;
-    tree.m_largestLength = *std::max_element(this->m_lengths.begin(), this->m_lengths.end());
-    tree.m_huffmanCodes = std::vector<uint16_t>(1 << tree.m_largestLength);
+bool Tree::build() {
+    m_multiLiterals.clear();
+
+    if (m_lengths.empty()) {
+        return false;
+    }
+
+    m_lengthCounts.fill(0);
+    for (auto length : m_lengths) {
+        if (length > 16) {
+            return false;
+        }
+
+        m_lengthCounts[length]++;
+    }
+
+    m_largestLength = *std::max_element(m_lengths.begin(), m_lengths.end());
+    if (m_largestLength == 0) {
+        return false;
+    }
+
+    // The lengths must describe a complete tree, neither over-subscribed nor with unused codes
+    int64_t left = 1;
+    uint32_t code = 0;
+    uint16_t offset = 0;
+    m_lengthCounts[0] = 0;
+
+    for (uint8_t length = 1; length <= m_largestLength; length++) {
+        left = (left << 1) - m_lengthCounts[length];
+        if (left < 0) {
+            return false;
+        }
+
+        code = (code + m_lengthCounts[length - 1]) << 1;
+        m_firstCode[length] = code;
+        m_symbolOffsets[length] = offset;
+        offset += m_lengthCounts[length];
+    }
+
+    if (left != 0) {
+        return false;
+    }
+
+    // Canonical codes are ordered by length, then by symbol
+    auto next = m_symbolOffsets;
+    m_sortedSymbols.resize(offset);
+    for (size_t symbol = 0; symbol < m_lengths.size(); symbol++) {
+        if (m_lengths[symbol] != 0) {
+            m_sortedSymbols[next[m_lengths[symbol]]++] = static_cast<uint16_t>(symbol);
+        }
+    }
+
+    // Every code up to `m_tableBits` long fills the entries it prefixes, in order. The remaining
+    // entries are the prefixes of longer codes.
+    m_tableBits = std::min(m_largestLength, TABLE_BITS);
+    m_huffmanCodes.resize(size_t(1) << m_tableBits);
 
     size_t pos = 0;
-    for (uint8_t bit = 1; bit <= tree.m_largestLength; bit++) {
-        size_t amount = 1 << (tree.m_largestLength - bit);
-
-        for (size_t code = 0; code < this->m_lengths.size(); code++) {
-            // As soon as a code's path length matches with our bit index write the code as
-            // many times as the bit index itself represents.
-            if (this->m_lengths[code] == bit) {
-                for (size_t i = 0; i < amount; i++) {
-                    tree.m_huffmanCodes[pos++] = code;
-                }
-            }
+    for (uint8_t length = 1; length <= m_tableBits; length++) {
+        size_t amount = size_t(1) << (m_tableBits - length);
+
+        for (size_t i = 0; i < m_lengthCounts[length]; i++) {
+            std::fill_n(m_huffmanCodes.begin() + pos, amount, m_sortedSymbols[m_symbolOffsets[length] + i]);
+            pos += amount;
         }
     }
 
-    // If we didn't fill the entire table, the path lengths are invalid
+    std::fill(m_huffmanCodes.begin() + pos, m_huffmanCodes.end(), LONG_CODE);
+    return true;
+}
+
+uint16_t Tree::decodeLongElement(BitStream& stream) const {
+    uint32_t bits = stream.peekBits<uint32_t>(m_largestLength);
 
-    if (pos != tree.m_huffmanCodes.size()) {
+    for (uint8_t length = m_tableBits + 1; length <= m_largestLength; length++) {
+        uint32_t index = (bits >> (m_largestLength - length)) - m_firstCode[length];
+
+        if (index < m_lengthCounts[length]) {
+            stream.readBits(length);
+            return m_sortedSymbols[m_symbolOffsets[length] + index];
+        }
+    }
+
+    // Unreachable for a complete tree
+    return m_sortedSymbols.back();
+}
+
+std::optional<Tree> CanonicalTree::createInstance() const {
+    Tree tree(this->m_lengths.get_allocator().resource());
+    if (!this->buildInstance(tree)) {
         return std::nullopt;
     }
 
     return tree;
 }
 
-static Tree readPretree(BitStream& stream) {
-    std::vector<uint8_t> lengths(20);
+bool CanonicalTree::buildInstance(Tree& out) const {
+    out.m_lengths.assign(this->m_lengths.begin(), this->m_lengths.end());
+    return out.build();
+}
+
+static bool readPretree(BitStream& stream, Tree& pretree) {
+    pretree.m_lengths.resize(20);
     for (size_t i = 0; i < 20; i++) {
-        lengths[i] = stream.readBits<uint8_t>(4);
+        pretree.m_lengths[i] = stream.readBits<uint8_t>(4);
     }
 
-    return Tree::fromPathLengths(std::move(lengths));
+    return pretree.build();
+}
+
+ErrorCode CanonicalTree::updateRangeWithPretree(BitStream& stream, size_t start, size_t end) {
+    Tree pretree(this->m_lengths.get_allocator().resource());
+    return this->updateRangeWithPretree(stream, start, end, pretree);
 }
 
-void CanonicalTree::updateRangeWithPretree(BitStream& stream, size_t start, size_t end) {
-    Tree pretree = readPretree(stream);
+ErrorCode CanonicalTree::updateRangeWithPretree(BitStream& stream, size_t start, size_t end, Tree& pretree) {
+    if (!readPretree(stream, pretree)) {
+        return ErrorCode::InvalidTree;
+    }
+
+    // Runs are clamped to the end of the range, like other decoders tolerate
+    auto fill = [&](size_t i, size_t count, uint8_t value) {
+        std::fill_n(this->m_lengths.begin() + i, std::min(count, end - i), value);
+        return i + count;
+    };
 
     for (size_t i = start; i < end;) {
         auto code = pretree.decodeElement(stream);
@@ -73,20 +196,10 @@ void CanonicalTree::updateRangeWithPretree(BitStream& stream, size_t start, size
             i++;
         } else if (code == 17) {
             auto zeros = stream.readBits<uint8_t>(4);
-
-            for (size_t j = 0; j < zeros + 4; j++) {
-                this->m_lengths[i + j] = 0;
-            }
-
-            i += zeros + 4;
+            i = fill(i, zeros + 4, 0);
         } else if (code == 18) {
             auto zeros = stream.readBits<uint8_t>(5);
-
-            for (size_t j = 0; j < zeros + 20; j++) {
-                this->m_lengths[i + j] = 0;
-            }
-
-            i += zeros + 20;
+            i = fill(i, zeros + 20, 0);
         } else if (code == 19) {
             auto same = stream.readBits<uint8_t>(1);
 
@@ -94,19 +207,17 @@ void CanonicalTree::updateRangeWithPretree(BitStream& stream, size_t start, size
             // has a value range of [0, 16].
             auto newCode = pretree.decodeElement(stream);
             if (newCode > 16) {
-                throw LzxdError("updateRangeWithPretree: invalid newCode");
+                return ErrorCode::InvalidPretreeCode;
             }
 
             auto value = static_cast<uint8_t>(17 + this->m_lengths[i] - newCode) % 17;
-            for (size_t j = 0; j < same + 4; j++) {
-                this->m_lengths[i + j] = value;
-            }
-
-            i += same + 4;
+            i = fill(i, same + 4, value);
         } else {
-            throw LzxdError("updateRangeWithPretree: invalid code");
+            return ErrorCode::InvalidPretreeCode;
         }
     }
+
+    return ErrorCode::Ok;
 }
 
 } // namespace lzxd
\ No newline at end of file
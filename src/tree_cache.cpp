@@ -0,0 +1,95 @@
+#include <lzxd/tree_cache.hpp>
+#include "hash.hpp"
+#include <algorithm>
+#include <chrono>
+
+namespace lzxd {
+
+static size_t treeBytes(const Tree& tree) {
+    return sizeof(Tree)
+        + tree.m_lengths.capacity()
+        + tree.m_huffmanCodes.capacity() * sizeof(uint16_t)
+        + tree.m_multiLiterals.capacity() * sizeof(MultiLiteral)
+        + tree.m_sortedSymbols.capacity() * sizeof(uint16_t);
+}
+
+TreeCache::TreeCache(size_t maxBytes, std::pmr::memory_resource* resource) : m_maxBytes(maxBytes), m_resource(resource) {}
+
+std::shared_ptr<const Tree> TreeCache::get(std::span<const uint8_t> lengths, bool multiLiterals) {
+    uint64_t key = detail::hash64(lengths.data(), lengths.size(), multiLiterals ? 1 : 0);
+
+    {
+        std::lock_guard lock(m_mutex);
+
+        auto it = m_index.find(key);
+        // The lengths are compared as well, a colliding hash is only a miss
+        if (it != m_index.end() && std::ranges::equal(it->second->tree->m_lengths, lengths)) {
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            m_stats.hits++;
+            m_stats.savedNs += it->second->buildNs;
+            return it->second->tree;
+        }
+
+        m_stats.misses++;
+    }
+
+    // Built without holding the lock, decoders missing the same tree at once each build it
+    auto start = std::chrono::steady_clock::now();
+
+    Tree tree(m_resource);
+    tree.m_lengths.assign(lengths.begin(), lengths.end());
+    if (!tree.build()) {
+        return nullptr;
+    }
+
+    if (multiLiterals) {
+        tree.buildMultiLiterals();
+    }
+
+    auto buildNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    size_t bytes = treeBytes(tree);
+    auto shared = std::make_shared<const Tree>(std::move(tree));
+
+    std::lock_guard lock(m_mutex);
+
+    if (auto it = m_index.find(key); it != m_index.end()) {
+        m_stats.bytes -= it->second->bytes;
+        m_entries.erase(it->second);
+    }
+
+    m_entries.push_front({key, shared, buildNs, bytes});
+    m_index[key] = m_entries.begin();
+    m_stats.bytes += bytes;
+    this->evict();
+
+    return shared;
+}
+
+void TreeCache::evict() {
+    // The newest entry is kept even if it alone is over the limit
+    while (m_stats.bytes > m_maxBytes && m_entries.size() > 1) {
+        auto& entry = m_entries.back();
+        m_stats.bytes -= entry.bytes;
+        m_stats.evictions++;
+        m_index.erase(entry.key);
+        m_entries.pop_back();
+    }
+}
+
+TreeCacheStats TreeCache::stats() const {
+    std::lock_guard lock(m_mutex);
+
+    auto stats = m_stats;
+    stats.entries = m_entries.size();
+    return stats;
+}
+
+void TreeCache::clear() {
+    std::lock_guard lock(m_mutex);
+
+    m_entries.clear();
+    m_index.clear();
+    m_stats.bytes = 0;
+}
+
+} // namespace lzxd
@@ -1,103 +1,181 @@
 #include <lzxd/window.hpp>
 #include <lzxd/error.hpp>
 #include <cstring>
+#include <algorithm>
+#include <utility>
+
+#ifdef __linux__
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
 
 namespace lzxd::detail {
 
-void Window::push(uint8_t byte) {
-    this->data[this->position] = byte;
-    this->advance(1);
-}
+struct WindowSnapshot {
+    int fd;
+
+    ~WindowSnapshot() {
+#ifdef __linux__
+        close(fd);
+#endif
+    }
+};
+
+// Windows are aligned to cache lines
+static constexpr size_t WINDOW_ALIGNMENT = 64;
+// Granularity at which snapshots skip zeros
+static constexpr size_t SNAPSHOT_PAGE_SIZE = 4096;
 
-void Window::advance(size_t by) {
-    this->position += by;
-    if (this->position >= this->data.size()) {
-        this->position -= this->data.size();
+WindowBuffer::WindowBuffer(size_t size, std::pmr::memory_resource* resource) : m_size(size), m_resource(resource) {
+    if (size != 0) {
+        m_data = static_cast<uint8_t*>(m_resource->allocate(size, WINDOW_ALIGNMENT));
+        std::memset(m_data, 0, size);
     }
 }
 
-void Window::copyFromSelf(size_t offset, size_t length) {
-    // For the fast path:
-    // * Source cannot wrap around
-    // * `memmove` won't overwrite as we go but we need that
-    // * Destination cannot wrap around
-
-    if (offset <= this->position && length <= offset && this->position + length < this->data.size()) {
-        auto start = this->position - offset;
-        std::memmove(
-            this->data.data() + this->position,
-            this->data.data() + start,
-            length
-        );
-    } else {
-        auto mask = this->data.size() - 1;
-
-        for (size_t i = 0; i < length; i++) {
-            auto dst = (this->position + i) & mask;
-            auto src = (this->data.size() + this->position + i - offset) & mask;
-            this->data[dst] = this->data[src];
+WindowBuffer::WindowBuffer(const WindowBuffer& other) : WindowBuffer(other, other.m_resource) {}
+
+WindowBuffer::WindowBuffer(const WindowBuffer& other, std::pmr::memory_resource* resource) : m_size(other.m_size), m_resource(resource) {
+#ifdef __linux__
+    if (other.m_snapshot) {
+        void* mapping = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, other.m_snapshot->fd, 0);
+
+        if (mapping != MAP_FAILED) {
+            m_mapping = mapping;
+            m_data = static_cast<uint8_t*>(mapping);
+            m_snapshot = other.m_snapshot;
+            return;
         }
     }
+#endif
 
-    this->advance(length);
+    if (m_size != 0) {
+        m_data = static_cast<uint8_t*>(m_resource->allocate(m_size, WINDOW_ALIGNMENT));
+        std::memcpy(m_data, other.m_data, m_size);
+    }
 }
 
-void Window::copyFromBitstream(BitStream& stream, size_t length) {
-    if (length > this->data.size()) {
-        throw LzxdError("Window::copyFromBitstream: length is too large");
-    }
+WindowBuffer::WindowBuffer(WindowBuffer&& other) noexcept
+    : m_data(std::exchange(other.m_data, nullptr)),
+      m_size(std::exchange(other.m_size, 0)),
+      m_resource(other.m_resource),
+      m_mapping(std::exchange(other.m_mapping, nullptr)),
+      m_snapshot(std::move(other.m_snapshot)) {}
+
+WindowBuffer& WindowBuffer::operator=(WindowBuffer other) noexcept {
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    std::swap(m_resource, other.m_resource);
+    std::swap(m_mapping, other.m_mapping);
+    std::swap(m_snapshot, other.m_snapshot);
+    return *this;
+}
+
+WindowBuffer::~WindowBuffer() {
+    this->release();
+}
 
-    if (this->position + length > this->data.size()) {
-        auto shift = this->position + length - this->data.size();
-        this->position -= shift;
-
-        // No need to actually save the part we're about to overwrite because when reading
-        // with the bitstream we would also overwrite it anyway.
-        std::memmove(
-            this->data.data(),
-            this->data.data() + shift,
-            this->data.size() - shift
-        );
+void WindowBuffer::release() {
+#ifdef __linux__
+    if (m_mapping) {
+        munmap(m_mapping, m_size);
+    } else
+#endif
+    if (m_data) {
+        m_resource->deallocate(m_data, m_size, WINDOW_ALIGNMENT);
     }
 
-    stream.readBytesInto(this->data.data() + this->position, length);
-    this->advance(length);
+    m_data = nullptr;
+    m_mapping = nullptr;
+    m_snapshot.reset();
 }
 
-uint8_t* Window::pastView(size_t len) {
-    if (len > 32 * 1024) {
-        throw LzxdError("Window::pastView: chunk is too long");
+bool WindowBuffer::snapshot() {
+    if (m_snapshot) {
+        return true;
+    }
+
+#ifdef __linux__
+    int fd = memfd_create("lzxd-window", MFD_CLOEXEC);
+    if (fd < 0) {
+        return false;
     }
 
-    // Being at zero means we're actually at max length where is impossible for `len` to be
-    // bigger and we would not want to bother shifting the entire array to end where it was.
-    if (this->position != 0 && len > this->position) {
-        auto shift = len - this->position;
-        this->advance(shift);
+    auto snapshot = std::make_shared<WindowSnapshot>(fd);
 
-        auto tmp = std::vector<uint8_t>(
-            this->data.begin() + this->data.size() - shift,
-            this->data.end()
-        );
+    if (ftruncate(fd, static_cast<off_t>(m_size)) != 0) {
+        return false;
+    }
+
+    // The file starts out as zeros, so only runs of pages holding data are written. Most of the
+    // window is often still untouched, and writing it would only allocate memory.
+    static const uint8_t zeroPage[SNAPSHOT_PAGE_SIZE] = {};
+
+    for (size_t start = 0; start < m_size;) {
+        size_t end = start;
+        while (end < m_size && std::memcmp(m_data + end, zeroPage, std::min(SNAPSHOT_PAGE_SIZE, m_size - end)) != 0) {
+            end += SNAPSHOT_PAGE_SIZE;
+        }
+        end = std::min(end, m_size);
 
-        std::memmove(
-            this->data.data() + shift,
-            this->data.data(),
-            this->data.size() - shift
-        );
+        for (size_t pos = start; pos < end;) {
+            auto written = pwrite(fd, m_data + pos, end - pos, static_cast<off_t>(pos));
+            if (written <= 0) {
+                return false;
+            }
 
-        std::memcpy(this->data.data(), tmp.data(), shift);
+            pos += static_cast<size_t>(written);
+        }
+
+        start = end + SNAPSHOT_PAGE_SIZE;
     }
 
-    // Because we want to read behind us, being at zero means we are at the end
-    size_t pos;
+    m_snapshot = std::move(snapshot);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Window::copyPastInto(uint8_t* output, size_t len) const {
+    this->copyPastInto(output, len, len);
+}
+
+void Window::copyPastInto(uint8_t* output, size_t back, size_t len) const {
+    LZXD_DEBUG_ASSERT(back <= this->data.size() && len <= back);
+
+    auto start = (this->data.size() + this->position - back) & (this->data.size() - 1);
+
+    // Copy up to the end of the ring, then wrap around to the start
+    auto head = std::min(len, this->data.size() - start);
+    std::memcpy(output, this->data.data() + start, head);
+
+    if (head != len) {
+        std::memcpy(output + head, this->data.data(), len - head);
+    }
+}
+
+const uint8_t* Window::pastView(size_t len) {
+    LZXD_DEBUG_ASSERT(len <= this->data.size());
+
+    if (len <= this->position) {
+        return this->data.data() + this->position - len;
+    }
+
+    // Being at zero means we are at the end of the ring
     if (this->position == 0) {
-        pos = this->data.size();
-    } else {
-        pos = this->position;
+        return this->data.data() + this->data.size() - len;
+    }
+
+    // The range wraps around. Rather than rotating the whole window, only the requested bytes are
+    // gathered into a scratch buffer.
+    if (!tryReserve(this->scratch, len)) {
+        return nullptr;
     }
 
-    return this->data.data() + pos - len;
+    this->scratch.resize(len);
+    this->copyPastInto(this->scratch.data(), len);
+    return this->scratch.data();
 }
 
 } // namespace lzxd::detail
\ No newline at end of file
@@ -0,0 +1,423 @@
+#include "writer.hpp"
+#include <lzxd/lzxd.hpp>
+#include <lzxd/cache.hpp>
+#include <lzxd/memory.hpp>
+#include <lzxd/parallel.hpp>
+#include <lzxd/tree_cache.hpp>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace lzxd::test;
+using Clock = std::chrono::steady_clock;
+
+static double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const std::string& name, size_t bytes, double seconds) {
+    std::cout << std::left << std::setw(48) << name
+              << std::right << std::setw(10) << std::fixed << std::setprecision(1) << (bytes / seconds / (1024.0 * 1024.0)) << " MiB/s"
+              << std::setw(10) << std::setprecision(2) << (seconds * 1e9 / bytes) << " ns/B" << std::endl;
+}
+
+// Decodes the whole stream, only timing the chunks starting from `fromChunk`
+static double decodeStream(lzxd::Decoder& decoder, const EncodedStream& stream, size_t fromChunk, size_t& timedBytes) {
+    std::vector<uint8_t> output(stream.chunkSize);
+    double seconds = 0.0;
+    timedBytes = 0;
+
+    for (size_t i = 0; i < stream.chunks.size(); i++) {
+        auto start = Clock::now();
+        size_t len = decoder.decompressChunkInto(stream.chunks[i], output.data(), stream.chunkOutputSize(i));
+
+        if (i >= fromChunk) {
+            seconds += secondsSince(start);
+            timedBytes += len;
+        }
+    }
+
+    return seconds;
+}
+
+static void benchHugePages() {
+    for (size_t windowSize : {0x800000ul, 0x1000000ul, 0x2000000ul}) {
+        Encoder encoder(windowSize);
+        auto stream = encoder.encode(encoder.splitTokens(farMatchTokens(windowSize, windowSize, 16 * 1024 * 1024)));
+        size_t primeChunks = windowSize / stream.chunkSize;
+
+        for (bool huge : {false, true}) {
+            auto* resource = huge ? lzxd::hugePageResource() : std::pmr::get_default_resource();
+            lzxd::Decoder decoder(windowSize, resource);
+
+            size_t bytes;
+            double seconds = decodeStream(decoder, stream, primeChunks, bytes);
+            report("far offsets, " + std::to_string(windowSize >> 20) + " MiB window, " + (huge ? "huge pages" : "default"), bytes, seconds);
+        }
+    }
+}
+
+static void benchLiterals() {
+    constexpr size_t windowSize = 0x80000;
+    const std::string alphabet = "etaoinshrdlucmfw";
+
+    Encoder encoder(windowSize);
+    encoder.mainLengths() = textMainLengths(windowSize, alphabet);
+    auto stream = encoder.encode(encoder.splitTokens(textTokens(32 * 1024 * 1024, alphabet)));
+
+    lzxd::Decoder decoder(windowSize);
+    size_t bytes;
+    double seconds = decodeStream(decoder, stream, 0, bytes);
+    report("literal-heavy text, 5-bit literal codes", bytes, seconds);
+}
+
+static void benchInterleaved() {
+    constexpr size_t windowSize = 0x80000;
+    const std::string alphabet = "etaoinshrdlucmfw";
+
+    std::vector<EncodedStream> streams;
+    for (uint32_t i = 0; i < 4; i++) {
+        Encoder encoder(windowSize);
+        if (i % 2 == 0) {
+            encoder.mainLengths() = textMainLengths(windowSize, alphabet);
+            streams.push_back(encoder.encode(encoder.splitTokens(textTokens(8 * 1024 * 1024, alphabet, i))));
+        } else {
+            streams.push_back(encoder.encode(encoder.splitTokens(farMatchTokens(windowSize, 1024 * 1024, 7 * 1024 * 1024, i))));
+        }
+    }
+
+    for (size_t count : {1, 2, 3, 4}) {
+        size_t bytes = 0;
+        for (size_t i = 0; i < count; i++) {
+            bytes += streams[i].output.size();
+        }
+
+        std::vector<std::vector<uint8_t>> outputs(count, std::vector<uint8_t>(32768));
+
+        {
+            std::vector<lzxd::Decoder> decoders(count);
+            auto start = Clock::now();
+            for (size_t i = 0; i < count; i++) {
+                for (size_t c = 0; c < streams[i].chunks.size(); c++) {
+                    decoders[i].decompressChunkInto(streams[i].chunks[c], outputs[i].data(), streams[i].chunkOutputSize(c));
+                }
+            }
+            report(std::to_string(count) + " streams, sequential", bytes, secondsSince(start));
+        }
+
+        {
+            std::vector<lzxd::Decoder> decoders(count);
+            auto start = Clock::now();
+            for (size_t c = 0; c < streams[0].chunks.size(); c++) {
+                std::vector<lzxd::InterleavedChunk> batch;
+                for (size_t i = 0; i < count; i++) {
+                    auto& data = streams[i].chunks[c];
+                    batch.push_back({&decoders[i], data.data(), data.size(), outputs[i].data(), streams[i].chunkOutputSize(c)});
+                }
+                lzxd::Decoder::decompressInterleaved(batch);
+            }
+            report(std::to_string(count) + " streams, interleaved", bytes, secondsSince(start));
+        }
+    }
+}
+
+static void benchChunkSizes() {
+    constexpr size_t windowSize = 0x100000;
+    const std::string alphabet = "etaoinshrdlucmfw";
+
+    // Same data encoded with different frame sizes
+    auto text = textTokens(32 * 1024 * 1024, alphabet);
+
+    for (size_t chunkSize : {0x8000ul, 0x40000ul, 0x100000ul}) {
+        Encoder encoder(windowSize, chunkSize);
+        encoder.mainLengths() = textMainLengths(windowSize, alphabet);
+        auto stream = encoder.encode(encoder.splitTokens(text));
+
+        lzxd::Decoder decoder(windowSize);
+        size_t bytes;
+        double seconds = decodeStream(decoder, stream, 0, bytes);
+        report("text, " + std::to_string(chunkSize / 1024) + " KiB chunks", bytes, seconds);
+    }
+}
+
+static void benchFarOffsets() {
+    for (size_t windowSize = 0x100000; windowSize <= 0x2000000; windowSize *= 2) {
+        Encoder encoder(windowSize);
+        auto stream = encoder.encode(encoder.splitTokens(farMatchTokens(windowSize, windowSize, 16 * 1024 * 1024)));
+
+        lzxd::Decoder decoder(windowSize);
+        size_t bytes;
+        double seconds = decodeStream(decoder, stream, windowSize / stream.chunkSize, bytes);
+        report("far offsets, " + std::to_string(windowSize >> 20) + " MiB window", bytes, seconds);
+    }
+}
+
+static void benchParallel() {
+    constexpr size_t windowSize = 0x10000;
+    auto stream = independentTextChunks(windowSize, 0x8000, 1024);
+    lzxd::IndependentChunks chunks{stream.data.data(), stream.offsets, stream.output.size(), 0x8000, windowSize};
+    std::vector<uint8_t> output(stream.output.size());
+
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads <= cores; threads *= 2) {
+        auto start = Clock::now();
+        lzxd::decompressChunksParallel(chunks, output.data(), threads);
+        report("independent 32 KiB chunks, " + std::to_string(threads) + " threads", output.size(), secondsSince(start));
+    }
+}
+
+static void benchFramed() {
+    constexpr size_t windowSize = 0x100000;
+    Encoder encoder(windowSize);
+    auto stream = framedStream(encoder.encode(encoder.splitTokens(farMatchTokens(windowSize, windowSize, 32 * 1024 * 1024))));
+    lzxd::FramedChunks chunks{stream.data.data(), stream.offsets, stream.output.size(), 0x8000, windowSize};
+    std::vector<uint8_t> output(stream.output.size());
+
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads <= std::max(cores, 2u); threads *= 2) {
+        auto start = Clock::now();
+        lzxd::decompressFramedParallel(chunks, output.data(), threads);
+        report("framed 32 KiB chunks, 1 MiB window, " + std::to_string(threads) + " threads", output.size(), secondsSince(start));
+    }
+}
+
+static void benchTreeCache() {
+    constexpr size_t windowSize = 0x200000;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // Small independent chunks, where building the trees is a large part of decoding
+    for (size_t chunkSize : {size_t(0x1000), size_t(0x8000)}) {
+        auto stream = independentTextChunks(windowSize, chunkSize, 0x1000000 / chunkSize);
+        std::vector<uint8_t> output(stream.output.size());
+
+        for (bool cached : {false, true}) {
+            auto cache = cached ? std::make_shared<lzxd::TreeCache>() : nullptr;
+            lzxd::IndependentChunks chunks{stream.data.data(), stream.offsets, stream.output.size(), chunkSize, windowSize, cache};
+
+            auto start = Clock::now();
+            lzxd::decompressChunksParallel(chunks, output.data(), threads);
+            report(std::to_string(chunkSize >> 10) + " KiB chunks, " + (cached ? "tree cache" : "no cache"), output.size(), secondsSince(start));
+
+            if (cache) {
+                auto stats = cache->stats();
+                std::cout << "  " << stats.hits << " hits, " << stats.misses << " misses, "
+                          << std::fixed << std::setprecision(2) << double(stats.savedNs) / 1e6 << " ms of building saved" << std::endl;
+            }
+        }
+    }
+}
+
+static void benchClone() {
+    constexpr size_t windowSize = 0x2000000;
+    constexpr size_t clones = 16;
+
+    // A decoder primed with a full window, forked to decode one more chunk in each branch
+    Encoder encoder(windowSize);
+    auto stream = encoder.encode(encoder.splitTokens(farMatchTokens(windowSize, windowSize, 0x8000)));
+    size_t primed = windowSize / stream.chunkSize;
+
+    lzxd::Decoder decoder(windowSize);
+    for (size_t i = 0; i < primed; i++) {
+        decoder.decompressChunk(stream.chunks[i], stream.chunkOutputSize(i));
+    }
+
+    for (bool cow : {false, true}) {
+        double firstSeconds = 0, cloneSeconds = 0, decodeSeconds = 0;
+
+        for (size_t i = 0; i < clones; i++) {
+            auto start = Clock::now();
+            lzxd::Decoder branch = cow ? decoder.clone() : lzxd::Decoder(decoder);
+            (i == 0 ? firstSeconds : cloneSeconds) += secondsSince(start);
+
+            start = Clock::now();
+            branch.decompressChunk(stream.chunks[primed], stream.chunkOutputSize(primed));
+            decodeSeconds += secondsSince(start);
+        }
+
+        // The first clone also writes the snapshot
+        std::cout << std::left << std::setw(30) << (cow ? "32 MiB window, clone" : "32 MiB window, copy")
+                  << std::fixed << std::setprecision(1) << firstSeconds * 1e6 << " us first fork, "
+                  << cloneSeconds / (clones - 1) * 1e6 << " us per fork after, "
+                  << decodeSeconds / clones * 1e6 << " us per chunk decoded" << std::endl;
+    }
+}
+
+static void benchKernels() {
+    constexpr size_t windowSize = 0x80000;
+    const std::string alphabet = "etaoinshrdlucmfw";
+
+    Encoder textEncoder(windowSize);
+    textEncoder.mainLengths() = textMainLengths(windowSize, alphabet);
+    auto text = textEncoder.encode(textEncoder.splitTokens(textTokens(32 * 1024 * 1024, alphabet)));
+
+    Encoder farEncoder(windowSize);
+    auto far = farEncoder.encode(farEncoder.splitTokens(farMatchTokens(windowSize, windowSize, 16 * 1024 * 1024)));
+
+    for (auto [kernel, name] : {std::pair{lzxd::DecodeKernel::Scalar, "scalar"}, std::pair{lzxd::DecodeKernel::Avx2, "avx2"}}) {
+        if (!lzxd::Decoder::kernelSupported(kernel)) {
+            std::cout << name << " kernel not supported" << std::endl;
+            continue;
+        }
+
+        for (auto [stream, data] : {std::pair{"text", &text}, std::pair{"far offsets", &far}}) {
+            lzxd::Decoder decoder(windowSize);
+            decoder.setKernel(kernel);
+
+            size_t bytes;
+            double seconds = decodeStream(decoder, *data, 0, bytes);
+            report(std::string(stream) + ", " + name + " kernel", bytes, seconds);
+        }
+    }
+}
+
+static void benchView() {
+    constexpr size_t windowSize = 0x80000;
+    const std::string alphabet = "etaoinshrdlucmfw";
+
+    Encoder encoder(windowSize);
+    encoder.mainLengths() = textMainLengths(windowSize, alphabet);
+    auto stream = encoder.encode(encoder.splitTokens(textTokens(32 * 1024 * 1024, alphabet)));
+
+    // The consumer hashes each chunk, which is all it needs it for
+    auto consume = [](std::span<const uint8_t> bytes) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i + 8 <= bytes.size(); i += 8) {
+            uint64_t word;
+            std::memcpy(&word, bytes.data() + i, 8);
+            hash = (hash ^ word) * 0x100000001b3ull;
+        }
+        return hash;
+    };
+
+    for (bool view : {false, true}) {
+        lzxd::Decoder decoder(windowSize);
+        std::vector<uint8_t> output(stream.chunkSize);
+        volatile uint64_t sink = 0;
+
+        auto start = Clock::now();
+        for (size_t i = 0; i < stream.chunks.size(); i++) {
+            if (view) {
+                sink = sink ^ consume(decoder.decompressChunkView(stream.chunks[i], stream.chunkOutputSize(i)));
+            } else {
+                size_t len = decoder.decompressChunkInto(stream.chunks[i], output.data(), stream.chunkOutputSize(i));
+                sink = sink ^ consume({output.data(), len});
+            }
+        }
+
+        report(std::string("32 KiB chunks, hashed, ") + (view ? "view" : "copy"), stream.output.size(), secondsSince(start));
+    }
+}
+
+static void benchScatter() {
+    constexpr size_t windowSize = 0x80000;
+    constexpr size_t pageSize = 4096;
+    const std::string alphabet = "etaoinshrdlucmfw";
+
+    Encoder encoder(windowSize);
+    encoder.mainLengths() = textMainLengths(windowSize, alphabet);
+    auto stream = encoder.encode(encoder.splitTokens(textTokens(32 * 1024 * 1024, alphabet)));
+
+    // Every chunk is spread over pages taken from a pool, in no particular order
+    std::vector<uint8_t> pool(stream.chunkSize * 4);
+    std::vector<lzxd::OutputSegment> pages;
+    for (size_t i = 0; i < stream.chunkSize / pageSize; i++) {
+        pages.push_back({pool.data() + (i * 7 % (pool.size() / pageSize)) * pageSize, pageSize});
+    }
+
+    for (bool scatter : {false, true}) {
+        lzxd::Decoder decoder(windowSize);
+        std::vector<uint8_t> output(stream.chunkSize);
+
+        auto start = Clock::now();
+        for (size_t i = 0; i < stream.chunks.size(); i++) {
+            if (scatter) {
+                decoder.decompressChunkScatter(stream.chunks[i], pages, stream.chunkOutputSize(i));
+            } else {
+                size_t len = decoder.decompressChunkInto(stream.chunks[i], output.data(), stream.chunkOutputSize(i));
+                for (size_t offset = 0; offset < len; offset += pageSize) {
+                    std::memcpy(pages[offset / pageSize].base, output.data() + offset, std::min(pageSize, len - offset));
+                }
+            }
+        }
+
+        report(std::string("32 KiB chunks into 4 KiB pages, ") + (scatter ? "scatter" : "copy"), stream.output.size(), secondsSince(start));
+    }
+}
+
+static void benchCache() {
+    constexpr size_t windowSize = 0x80000;
+    const std::string alphabet = "etaoinshrdlucmfw";
+
+    Encoder encoder(windowSize);
+    encoder.mainLengths() = textMainLengths(windowSize, alphabet);
+    auto stream = encoder.encode(encoder.splitTokens(textTokens(64 * 1024 * 1024, alphabet)));
+
+    std::vector<uint8_t> input;
+    for (auto& chunk : stream.chunks) {
+        input.insert(input.end(), chunk.begin(), chunk.end());
+    }
+
+    auto directory = std::filesystem::temp_directory_path() / "lzxd-cache-bench";
+    std::filesystem::remove_all(directory);
+    lzxd::DiskCache cache(directory);
+    auto key = lzxd::DiskCache::key(input.data(), input.size(), windowSize, stream.output.size(), stream.chunkSize);
+
+    auto decode = [&]() -> lzxd::Result<std::vector<uint8_t>> {
+        lzxd::Decoder decoder(windowSize);
+        std::vector<uint8_t> output(stream.output.size());
+        for (size_t i = 0; i < stream.chunks.size(); i++) {
+            decoder.decompressChunkInto(stream.chunks[i], output.data() + i * stream.chunkSize, stream.chunkOutputSize(i));
+        }
+        return output;
+    };
+
+    for (const char* name : {"cold start (decode and store)", "warm start (map)"}) {
+        auto start = Clock::now();
+        auto result = cache.getOrDecode(key, decode);
+
+        // Touch every page, as a consumer would
+        volatile uint8_t sink = 0;
+        for (size_t i = 0; i < result.value().size(); i += 4096) {
+            sink = sink ^ result.value().data()[i];
+        }
+
+        report(name, result.value().size(), secondsSince(start));
+    }
+
+    std::filesystem::remove_all(directory);
+}
+
+int main(int argc, const char** argv) {
+    std::vector<std::pair<std::string, std::function<void()>>> benches = {
+        {"hugepages", benchHugePages},
+        {"far", benchFarOffsets},
+        {"literals", benchLiterals},
+        {"interleaved", benchInterleaved},
+        {"chunks", benchChunkSizes},
+        {"parallel", benchParallel},
+        {"kernels", benchKernels},
+        {"cache", benchCache},
+        {"view", benchView},
+        {"scatter", benchScatter},
+        {"framed", benchFramed},
+        {"trees", benchTreeCache},
+        {"clone", benchClone},
+    };
+
+    for (auto& [name, fn] : benches) {
+        if (argc > 1 && name != argv[1]) {
+            continue;
+        }
+
+        std::cout << "== " << name << std::endl;
+        fn();
+    }
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+// libFuzzer target searching for inputs that are slow to decode, rather than only for crashes.
+//
+// Input: one byte selecting the window size, then chunks, each prefixed by its compressed size
+// and output size as 16-bit little-endian integers.
+//
+// The time spent per input and output byte is reported to libFuzzer as extra coverage, so that
+// inputs reaching a new cost bucket are kept and mutated further, and inputs above the limit abort.
+// Built with LZXD_FUZZ_STANDALONE, every file given on the command line is run instead, which is
+// how the regression corpus in test/corpus is tested.
+
+#include <lzxd/lzxd.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#ifdef LZXD_FUZZ_STANDALONE
+# include <filesystem>
+# include <fstream>
+# include <iostream>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Decoding slower than this is considered a bug, overridable with LZXD_FUZZ_MAX_NS_PER_BYTE.
+// Normal data takes a few ns per byte, and the hostile corpus under 1000 in unoptimized builds.
+constexpr double MAX_NS_PER_BYTE = 5000.0;
+// Shorter runs are too noisy to be judged
+constexpr double MIN_JUDGED_NS = 1e6;
+
+#if defined(__linux__) && !defined(LZXD_FUZZ_STANDALONE)
+// One counter per log2 bucket of nanoseconds per 1/16th byte
+__attribute__((section("__libfuzzer_extra_counters"))) uint8_t g_costCounters[64];
+#endif
+
+double maxNsPerByte() {
+    static double limit = [] {
+        const char* env = std::getenv("LZXD_FUZZ_MAX_NS_PER_BYTE");
+        return env ? std::atof(env) : MAX_NS_PER_BYTE;
+    }();
+
+    return limit;
+}
+
+lzxd::Decoder& decoderFor(uint8_t selector) {
+    // Constructing a decoder zeroes its window, which would dominate the timings
+    static std::array<std::unique_ptr<lzxd::Decoder>, 7> decoders;
+
+    auto& decoder = decoders[selector % decoders.size()];
+    if (!decoder) {
+        decoder = std::make_unique<lzxd::Decoder>(size_t(0x8000) << (selector % decoders.size()));
+    }
+
+    decoder->reset();
+    return *decoder;
+}
+
+uint16_t readU16(const uint8_t* data) {
+    return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+struct Run {
+    size_t produced;
+    size_t requested; // output size of every chunk attempted, which bounds the work as much as the input does
+    double ns;
+
+    double nsPerByte(size_t size) const {
+        return ns / double(size + requested);
+    }
+};
+
+Run decodeInput(const uint8_t* data, size_t size) {
+    static std::vector<uint8_t> output(lzxd::DEFAULT_CHUNK_SIZE);
+
+    auto& decoder = decoderFor(data[0]);
+    size_t pos = 1, produced = 0, requested = 0;
+
+    auto start = Clock::now();
+    while (pos + 4 <= size) {
+        size_t chunkSize = std::min<size_t>(readU16(data + pos), size - pos - 4);
+        size_t outputSize = std::min<size_t>(readU16(data + pos + 2), output.size());
+        pos += 4;
+        requested += outputSize;
+
+        auto result = decoder.tryDecompressChunkInto(data + pos, chunkSize, output.data(), outputSize);
+        if (!result) {
+            break;
+        }
+
+        pos += chunkSize;
+        produced += result.value();
+    }
+
+    return {produced, requested, std::chrono::duration<double, std::nano>(Clock::now() - start).count()};
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size < 1) {
+        return 0;
+    }
+
+    auto run = decodeInput(data, size);
+    double nsPerByte = run.nsPerByte(size);
+
+#if defined(__linux__) && !defined(LZXD_FUZZ_STANDALONE)
+    size_t bucket = 0;
+    while (bucket + 1 < std::size(g_costCounters) && (uint64_t(1) << bucket) <= nsPerByte * 16) {
+        bucket++;
+    }
+    g_costCounters[bucket]++;
+#endif
+
+    if (run.ns >= MIN_JUDGED_NS && nsPerByte > maxNsPerByte()) {
+        std::fprintf(stderr, "lzxd fuzz: %.1f ns per byte over %zu input and %zu output bytes\n", nsPerByte, size, run.requested);
+        std::abort();
+    }
+
+    return 0;
+}
+
+#ifdef LZXD_FUZZ_STANDALONE
+
+int main(int argc, const char** argv) {
+    std::vector<std::filesystem::path> files;
+
+    for (int i = 1; i < argc; i++) {
+        if (std::filesystem::is_directory(argv[i])) {
+            for (auto& entry : std::filesystem::directory_iterator(argv[i])) {
+                files.push_back(entry.path());
+            }
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    std::sort(files.begin(), files.end());
+
+    for (auto& path : files) {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<uint8_t> data{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+
+        std::cout << path.filename().string() << ": " << data.size() << " bytes" << std::endl;
+        LLVMFuzzerTestOneInput(data.data(), data.size());
+
+        if (!data.empty()) {
+            auto run = decodeInput(data.data(), data.size());
+            std::printf("  %zu bytes decoded, %.1f ns per byte\n", run.produced, run.nsPerByte(data.size()));
+        }
+    }
+
+    std::cout << "Ran " << files.size() << " inputs" << std::endl;
+    return 0;
+}
+
+#endif
@@ -1,7 +1,17 @@
 #include <lzxd/lzxd.hpp>
 #include <lzxd/error.hpp>
-#include <lzxd/ldi.hpp>
+#include <lzxd/cache.hpp>
+#include <lzxd/memory.hpp>
+#include <lzxd/parallel.hpp>
+#include <lzxd/tree_cache.hpp>
+#include "writer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 #include <iostream>
+#include <random>
 #include <filesystem>
 #include <fstream>
 
@@ -16,6 +26,30 @@
 # define BSWAP64(val) __builtin_bswap64(val)
 #endif
 
+// Counts every allocation made through the global operator new
+static std::atomic<size_t> g_allocations = 0;
+
+void* operator new(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+#if LZXD_EXCEPTIONS
+    throw std::bad_alloc();
+#else
+    std::abort();
+#endif
+}
+
+// Not inlined, or GCC sees `free` called on the result of a `new` expression and warns about it
+[[gnu::noinline]] void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+[[gnu::noinline]] void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
 void testBitBuffer() {
     []{
         // Test readU32le
@@ -103,6 +137,1077 @@ void testDecoder() {
     }();
 }
 
+// Decodes every chunk of the stream and compares against the expected output
+static void checkStream(lzxd::Decoder& decoder, const lzxd::test::EncodedStream& stream) {
+    size_t offset = 0;
+    for (size_t i = 0; i < stream.chunks.size(); i++) {
+        auto out = decoder.decompressChunk(stream.chunks[i], stream.chunkOutputSize(i));
+        LZXD_ASSERT(out.size() == stream.chunkOutputSize(i));
+        LZXD_ASSERT(std::memcmp(out.data(), stream.output.data() + offset, out.size()) == 0);
+        offset += out.size();
+    }
+
+    LZXD_ASSERT(offset == stream.output.size());
+}
+
+void testAllocator() {
+    struct CountingResource : std::pmr::memory_resource {
+        size_t allocations = 0, live = 0;
+
+        void* do_allocate(size_t bytes, size_t alignment) override {
+            allocations++;
+            live += bytes;
+            return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+            live -= bytes;
+            std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+    };
+
+    constexpr size_t windowSize = 0x80000;
+    lzxd::test::Encoder encoder(windowSize);
+    auto stream = encoder.encode(encoder.splitTokens(lzxd::test::farMatchTokens(windowSize, windowSize, 0x40000)));
+
+    [&] {
+        // Every internal buffer goes through the resource
+        CountingResource resource;
+        {
+            lzxd::Decoder decoder(windowSize, &resource);
+            LZXD_ASSERT(resource.live >= windowSize);
+
+            // Everything is allocated up front
+            size_t allocations = resource.allocations;
+            checkStream(decoder, stream);
+
+            decoder.reset();
+            checkStream(decoder, stream);
+            LZXD_ASSERT(resource.allocations == allocations);
+        }
+        LZXD_ASSERT(resource.live == 0);
+    }();
+
+    [&] {
+        // Clones allocate from the resource of the decoder, not the default one
+        CountingResource resource, fallback;
+        lzxd::Decoder decoder(windowSize, &resource);
+        decoder.decompressChunk(stream.chunks[0], stream.chunkOutputSize(0));
+
+        auto previous = std::pmr::set_default_resource(&fallback);
+        size_t allocations = resource.allocations;
+        {
+            auto clone = decoder.clone();
+            LZXD_ASSERT(resource.allocations > allocations);
+
+            for (size_t i = 1; i < stream.chunks.size(); i++) {
+                auto chunk = clone.decompressChunk(stream.chunks[i], stream.chunkOutputSize(i));
+                LZXD_ASSERT(std::equal(chunk.begin(), chunk.end(), stream.output.begin() + i * stream.chunkSize));
+            }
+        }
+        std::pmr::set_default_resource(previous);
+
+        LZXD_ASSERT(fallback.allocations == 0);
+    }();
+
+    [&] {
+        // Assignment keeps the resource of the target, so the source's resource can go away first
+        auto decodeRest = [&](lzxd::Decoder& decoder) {
+            for (size_t i = 1; i < stream.chunks.size(); i++) {
+                auto chunk = decoder.decompressChunk(stream.chunks[i], stream.chunkOutputSize(i));
+                LZXD_ASSERT(std::equal(chunk.begin(), chunk.end(), stream.output.begin() + i * stream.chunkSize));
+            }
+        };
+
+        CountingResource target;
+        lzxd::Decoder copied(windowSize, &target), moved(windowSize, &target);
+
+        for (bool move : {false, true}) {
+            CountingResource source;
+            {
+                lzxd::Decoder decoder(windowSize, &source);
+                decoder.decompressChunk(stream.chunks[0], stream.chunkOutputSize(0));
+
+                size_t live = source.live;
+                if (move) {
+                    moved = std::move(decoder);
+                } else {
+                    copied = decoder;
+                }
+                LZXD_ASSERT(source.live == live);
+            }
+            LZXD_ASSERT(source.live == 0);
+        }
+
+        size_t allocations = target.allocations;
+        decodeRest(copied);
+        decodeRest(moved);
+        LZXD_ASSERT(target.allocations == allocations);
+
+        // Between decoders sharing a resource, moving takes the buffers over
+        lzxd::Decoder other(windowSize, &target);
+        allocations = target.allocations;
+        other = std::move(moved);
+        LZXD_ASSERT(target.allocations == allocations);
+    }();
+
+    [&] {
+        lzxd::Decoder decoder(windowSize, lzxd::hugePageResource());
+        checkStream(decoder, stream);
+    }();
+}
+
+void testMultiLiterals() {
+    constexpr size_t windowSize = 0x80000;
+    const std::string alphabet = "etaoinshrdlucmfw";
+
+    [&] {
+        // Short literal codes, decoded through the multi-literal table
+        lzxd::test::Encoder encoder(windowSize, 32768, 20000);
+        encoder.mainLengths() = lzxd::test::textMainLengths(windowSize, alphabet);
+
+        auto stream = encoder.encode(encoder.splitTokens(lzxd::test::textTokens(200000, alphabet)));
+        lzxd::Decoder decoder(windowSize);
+        checkStream(decoder, stream);
+    }();
+
+    [&] {
+        auto lengths = lzxd::test::textMainLengths(windowSize, alphabet);
+
+        auto tree = lzxd::Tree::fromPathLengths(std::pmr::vector<uint8_t>(lengths.begin(), lengths.end()));
+        tree.buildMultiLiterals();
+        LZXD_ASSERT(tree.m_multiLiterals.size() == (1 << lzxd::Tree::MULTI_LITERAL_BITS));
+
+        // Two 5-bit codes fit in 12 bits, a 9-bit match code does not
+        auto& entry = tree.m_multiLiterals[0];
+        LZXD_ASSERT(entry.count == 2 && entry.bits == 10);
+
+        // Not profitable with long literal codes
+        auto longLengths = lzxd::test::completeLengths(560);
+        auto longTree = lzxd::Tree::fromPathLengths(std::pmr::vector<uint8_t>(longLengths.begin(), longLengths.end()));
+        longTree.buildMultiLiterals();
+        LZXD_ASSERT(longTree.m_multiLiterals.empty());
+    }();
+}
+
+void testLongCodes() {
+    // Skewed lengths reaching 16 bits, longer than the primary table
+    std::vector<uint8_t> lengths(496);
+    for (size_t i = 0; i < 15; i++) {
+        lengths[i] = static_cast<uint8_t>(i + 1);
+    }
+    lengths[15] = lengths[16] = 16;
+
+    [&] {
+        auto tree = lzxd::Tree::fromPathLengths(std::pmr::vector<uint8_t>(lengths.begin(), lengths.end()));
+        LZXD_ASSERT(tree.m_huffmanCodes.size() == (1 << lzxd::Tree::TABLE_BITS));
+
+        auto codes = lzxd::test::canonicalCodes(lengths);
+        lzxd::test::BitWriter writer;
+        for (size_t i = 0; i < 200; i++) {
+            writer.write(codes[i % 17].bits, codes[i % 17].length);
+        }
+
+        auto data = writer.take();
+        lzxd::BitStream stream(data.data(), data.size());
+        for (size_t i = 0; i < 200; i++) {
+            LZXD_ASSERT(tree.decodeElement(stream) == i % 17);
+        }
+    }();
+
+    [&] {
+        // A block per literal, each rebuilding its trees
+        std::vector<lzxd::test::Token> tokens;
+        for (size_t i = 0; i < 3000; i++) {
+            tokens.push_back(lzxd::test::Token::literal(static_cast<uint8_t>(i % 3 == 0 ? 16 - i % 2 : i % 17)));
+        }
+
+        for (size_t blockSize : {1, 0x10000}) {
+            lzxd::test::Encoder encoder(0x8000, 32768, blockSize);
+            encoder.mainLengths() = lengths;
+
+            auto stream = encoder.encode(tokens);
+            lzxd::Decoder decoder(0x8000);
+            checkStream(decoder, stream);
+        }
+    }();
+}
+
+void testInterleaved() {
+    const std::string alphabet = "etaoinshrdlucmfw";
+
+    // Decodes the streams chunk by chunk, each batch holding the next chunk of every stream not done yet
+    auto decodeInterleaved = [](const std::vector<lzxd::test::EncodedStream>& streams, std::vector<lzxd::Decoder>& decoders) {
+        std::vector<std::vector<uint8_t>> outputs(streams.size());
+
+        for (size_t chunk = 0;; chunk++) {
+            std::vector<lzxd::InterleavedChunk> batch;
+            std::vector<size_t> owners;
+
+            for (size_t i = 0; i < streams.size(); i++) {
+                if (chunk < streams[i].chunks.size()) {
+                    outputs[i].resize(outputs[i].size() + streams[i].chunkOutputSize(chunk));
+                    auto& data = streams[i].chunks[chunk];
+                    batch.push_back({&decoders[i], data.data(), data.size(), outputs[i].data() + chunk * streams[i].chunkSize, streams[i].chunkOutputSize(chunk)});
+                    owners.push_back(i);
+                }
+            }
+
+            if (batch.empty()) {
+                break;
+            }
+
+            lzxd::Decoder::decompressInterleaved(batch);
+
+            for (size_t j = 0; j < batch.size(); j++) {
+                LZXD_ASSERT(batch[j].error == lzxd::ErrorCode::Ok);
+                LZXD_ASSERT(batch[j].decodedLen == streams[owners[j]].chunkOutputSize(chunk));
+            }
+        }
+
+        for (size_t i = 0; i < streams.size(); i++) {
+            LZXD_ASSERT(outputs[i] == streams[i].output);
+        }
+    };
+
+    [&] {
+        // Streams of different kinds and lengths, so some finish early
+        constexpr size_t windowSize = 0x80000;
+        std::vector<lzxd::test::EncodedStream> streams;
+        std::vector<lzxd::Decoder> decoders;
+
+        for (uint32_t i = 0; i < 5; i++) {
+            lzxd::test::Encoder encoder(windowSize);
+            if (i % 2 == 0) {
+                encoder.mainLengths() = lzxd::test::textMainLengths(windowSize, alphabet);
+                streams.push_back(encoder.encode(encoder.splitTokens(lzxd::test::textTokens(100000 + i * 30000, alphabet, i))));
+            } else {
+                streams.push_back(encoder.encode(encoder.splitTokens(lzxd::test::farMatchTokens(windowSize, 100000, i * 20000, i))));
+            }
+            decoders.emplace_back(windowSize);
+        }
+
+        decodeInterleaved(streams, decoders);
+    }();
+
+    [&] {
+        // Codes longer than the lookup table, which leave the loop for `decodeStep`, next to a stream in a
+        // window large enough for far matches to be held back for prefetching
+        std::vector<uint8_t> lengths(496);
+        for (size_t i = 0; i < 15; i++) {
+            lengths[i] = static_cast<uint8_t>(i + 1);
+        }
+        lengths[15] = lengths[16] = 16;
+
+        std::vector<lzxd::test::Token> tokens;
+        for (size_t i = 0; i < 100000; i++) {
+            tokens.push_back(lzxd::test::Token::literal(static_cast<uint8_t>(i % 3 == 0 ? 16 - i % 2 : i % 17)));
+        }
+
+        lzxd::test::Encoder longCodes(0x8000);
+        longCodes.mainLengths() = lengths;
+
+        constexpr size_t largeWindow = 0x400000;
+        lzxd::test::Encoder far(largeWindow);
+
+        std::vector<lzxd::test::EncodedStream> streams = {
+            longCodes.encode(longCodes.splitTokens(tokens)),
+            far.encode(far.splitTokens(lzxd::test::farMatchTokens(largeWindow, largeWindow, 0x40000))),
+        };
+
+        std::vector<lzxd::Decoder> decoders;
+        decoders.emplace_back(0x8000);
+        decoders.emplace_back(largeWindow);
+        decodeInterleaved(streams, decoders);
+    }();
+}
+
+void testUncompressedBlocks() {
+    constexpr size_t windowSize = 0x8000;
+    using lzxd::test::Token;
+
+    std::mt19937 rng(7);
+    std::vector<uint8_t> raw(100001);
+    for (auto& byte : raw) {
+        byte = static_cast<uint8_t>(rng());
+    }
+
+    // Odd-sized uncompressed blocks that wrap around the ring and span several chunks,
+    // interleaved with compressed blocks referencing them
+    std::vector<Token> tokens;
+    size_t rawOffset = 0;
+    for (uint32_t len : {5u, 40001u, 3u, 20000u, 32768u}) {
+        for (int i = 0; i < 100; i++) {
+            tokens.push_back(Token::literal(static_cast<uint8_t>(i)));
+        }
+        tokens.push_back(Token::match(50, 100));
+
+        tokens.push_back(Token::uncompressed(raw.data() + rawOffset, len));
+        rawOffset += len;
+    }
+    tokens.push_back(Token::match(20000, 200));
+
+    lzxd::test::Encoder encoder(windowSize);
+    auto stream = encoder.encode(encoder.splitTokens(tokens));
+
+    lzxd::Decoder decoder(windowSize);
+    checkStream(decoder, stream);
+}
+
+void testChunkSizes() {
+    constexpr size_t windowSize = 0x100000;
+
+    for (size_t chunkSize : {0x8000ul, 0x40000ul, 0x100000ul}) {
+        lzxd::test::Encoder encoder(windowSize, chunkSize, 0x30000);
+        auto stream = encoder.encode(encoder.splitTokens(lzxd::test::farMatchTokens(windowSize, 0x180000, 0x100000, 3)));
+
+        lzxd::Decoder decoder(windowSize);
+        checkStream(decoder, stream);
+    }
+
+    [] {
+        lzxd::Decoder decoder(0x8000);
+        std::vector<uint8_t> data(16), output(0x10000);
+
+        auto result = decoder.tryDecompressChunkInto(data.data(), data.size(), output.data(), 0x10000);
+        LZXD_ASSERT(result.error() == lzxd::ErrorCode::ChunkTooLarge);
+    }();
+}
+
+void testChunkViews() {
+    constexpr size_t windowSize = 0x10000;
+
+    // Chunk sizes that divide the window, and one that does not so some chunks wrap around the ring
+    for (size_t chunkSize : {0x8000ul, 0x6000ul}) {
+        lzxd::test::Encoder encoder(windowSize, chunkSize);
+        auto stream = encoder.encode(encoder.splitTokens(lzxd::test::farMatchTokens(windowSize, 0x20000, 0x20000)));
+
+        lzxd::Decoder decoder(windowSize);
+        size_t offset = 0;
+        for (size_t i = 0; i < stream.chunks.size(); i++) {
+            auto view = decoder.decompressChunkView(stream.chunks[i], stream.chunkOutputSize(i));
+            LZXD_ASSERT(view.size() == stream.chunkOutputSize(i));
+            LZXD_ASSERT(std::memcmp(view.data(), stream.output.data() + offset, view.size()) == 0);
+            offset += view.size();
+        }
+
+        LZXD_ASSERT(offset == stream.output.size());
+    }
+
+    [] {
+        lzxd::Decoder decoder(0x8000);
+        std::vector<uint8_t> data(4);
+        auto result = decoder.tryDecompressChunkView(data.data(), data.size());
+        LZXD_ASSERT(!result.ok());
+    }();
+}
+
+void testScatterOutput() {
+    constexpr size_t windowSize = 0x10000;
+    lzxd::test::Encoder encoder(windowSize, 0x6000);
+    auto stream = encoder.encode(encoder.splitTokens(lzxd::test::farMatchTokens(windowSize, 0x20000, 0x20000)));
+
+    [&] {
+        // Segments of uneven sizes, including empty ones and spare room at the end
+        std::vector<uint8_t> output;
+        lzxd::Decoder decoder(windowSize);
+
+        for (size_t i = 0; i < stream.chunks.size(); i++) {
+            std::vector<std::vector<uint8_t>> buffers;
+            for (size_t size : {1ul, 0ul, 4095ul, 7ul, 0x10000ul}) {
+                buffers.emplace_back(size);
+            }
+
+            std::vector<lzxd::OutputSegment> segments;
+            for (auto& buffer : buffers) {
+                segments.push_back({buffer.data(), buffer.size()});
+            }
+
+            size_t len = decoder.decompressChunkScatter(stream.chunks[i], segments, stream.chunkOutputSize(i));
+            LZXD_ASSERT(len == stream.chunkOutputSize(i));
+
+            for (auto& buffer : buffers) {
+                auto part = std::min(buffer.size(), len);
+                output.insert(output.end(), buffer.begin(), buffer.begin() + part);
+                len -= part;
+            }
+        }
+
+        LZXD_ASSERT(output == stream.output);
+    }();
+
+    [&] {
+        // Not enough room, nothing is decoded
+        std::vector<uint8_t> buffer(100);
+        lzxd::OutputSegment segment{buffer.data(), buffer.size()};
+        lzxd::Decoder decoder(windowSize);
+
+        auto result = decoder.tryDecompressChunkScatter(stream.chunks[0].data(), stream.chunks[0].size(), {&segment, 1}, stream.chunkOutputSize(0));
+        LZXD_ASSERT(result.error() == lzxd::ErrorCode::OutputTooSmall);
+
+        std::vector<uint8_t> output(stream.chunkSize);
+        decoder.decompressChunkInto(stream.chunks[0], output.data(), stream.chunkOutputSize(0));
+        LZXD_ASSERT(std::memcmp(output.data(), stream.output.data(), stream.chunkOutputSize(0)) == 0);
+    }();
+}
+
+void testValidateAndSkip() {
+    constexpr size_t windowSize = 0x80000;
+    lzxd::test::Encoder encoder(windowSize);
+    auto stream = encoder.encode(encoder.splitTokens(lzxd::test::farMatchTokens(windowSize, 0x40000, 0x40000)));
+
+    [&] {
+        lzxd::Decoder decoder(windowSize);
+        size_t total = 0;
+        for (size_t i = 0; i < stream.chunks.size(); i++) {
+            total += decoder.validateChunk(stream.chunks[i], stream.chunkOutputSize(i));
+        }
+        LZXD_ASSERT(total == stream.output.size());
+    }();
+
+    [&] {
+        // Skip the first half, then decode the rest
+        lzxd::Decoder decoder(windowSize);
+        size_t half = stream.chunks.size() / 2;
+        for (size_t i = 0; i < half; i++) {
+            LZXD_ASSERT(decoder.skipChunk(stream.chunks[i], stream.chunkOutputSize(i)) == stream.chunkOutputSize(i));
+        }
+
+        for (size_t i = half; i < stream.chunks.size(); i++) {
+            auto out = decoder.decompressChunk(stream.chunks[i], stream.chunkOutputSize(i));
+            LZXD_ASSERT(std::memcmp(out.data(), stream.output.data() + i * stream.chunkSize, out.size()) == 0);
+        }
+    }();
+
+    [&] {
+        // A match reaching before the start of the stream fails however the chunk is decoded
+        lzxd::test::Encoder badEncoder(windowSize);
+        badEncoder.checkOffsets = false;
+
+        std::vector<lzxd::test::Token> tokens(100, lzxd::test::Token::literal('a'));
+        tokens.push_back(lzxd::test::Token::match(1000, 10));
+        auto bad = badEncoder.encode(tokens);
+        auto& chunk = bad.chunks[0];
+
+        lzxd::Decoder decoder(windowSize);
+        LZXD_ASSERT(decoder.trySkipChunk(chunk.data(), chunk.size(), 110).error() == lzxd::ErrorCode::MatchOutOfBounds);
+
+        lzxd::Decoder validator(windowSize);
+        auto result = validator.tryValidateChunk(chunk.data(), chunk.size(), bad.chunkOutputSize(0));
+        LZXD_ASSERT(result.error() == lzxd::ErrorCode::MatchOutOfBounds);
+    }();
+
+    [&] {
+        // After a reset, the previous stream is still in the window but cannot be read. The match is
+        // preceded by enough literals for the kernels and the interleaved lanes to reach it.
+        std::vector<uint8_t> secret(0x8000, 's');
+        lzxd::test::Encoder encoder(windowSize);
+        auto first = encoder.encode({lzxd::test::Token::uncompressed(secret.data(), secret.size())});
+
+        lzxd::test::Encoder badEncoder(windowSize);
+        badEncoder.checkOffsets = false;
+        std::vector<lzxd::test::Token> tokens(2000, lzxd::test::Token::literal('a'));
+        tokens.push_back(lzxd::test::Token::match(0x4000, 200));
+        tokens.insert(tokens.end(), 1000, lzxd::test::Token::literal('a'));
+        auto bad = badEncoder.encode(tokens);
+        auto& chunk = bad.chunks[0];
+
+        for (auto kernel : {lzxd::DecodeKernel::Scalar, lzxd::DecodeKernel::Avx2}) {
+            if (!lzxd::Decoder::kernelSupported(kernel)) {
+                continue;
+            }
+
+            lzxd::Decoder decoder(windowSize);
+            decoder.setKernel(kernel);
+            checkStream(decoder, first);
+            decoder.reset();
+
+            std::vector<uint8_t> output(bad.output.size());
+            auto result = decoder.tryDecompressChunkInto(chunk.data(), chunk.size(), output.data(), output.size());
+            LZXD_ASSERT(result.error() == lzxd::ErrorCode::MatchOutOfBounds);
+
+            decoder.reset();
+            checkStream(decoder, first);
+            decoder.reset();
+
+            lzxd::InterleavedChunk batch[] = {{&decoder, chunk.data(), chunk.size(), output.data(), output.size()}};
+            lzxd::Decoder::decompressInterleaved(batch);
+            LZXD_ASSERT(batch[0].error == lzxd::ErrorCode::MatchOutOfBounds);
+            LZXD_ASSERT(std::find(output.begin(), output.end(), 's') == output.end());
+        }
+    }();
+}
+
+void testCorruptInput() {
+    constexpr size_t windowSize = 0x80000;
+    lzxd::test::Encoder encoder(windowSize);
+    auto stream = encoder.encode(encoder.splitTokens(lzxd::test::farMatchTokens(windowSize, 0x40000, 0x40000)));
+    std::vector<uint8_t> output(stream.chunkSize);
+
+    [&] {
+        // Every truncation of a chunk fails cleanly
+        auto& chunk = stream.chunks[0];
+        for (size_t len = 0; len < chunk.size(); len += 7) {
+            lzxd::Decoder decoder(windowSize);
+            auto result = decoder.tryDecompressChunkInto(chunk.data(), len, output.data(), stream.chunkOutputSize(0));
+            LZXD_ASSERT(!result.ok());
+        }
+    }();
+
+    [&] {
+        // Random bit flips never crash, the decoder can be reused after a reset
+        std::mt19937 rng(1);
+        lzxd::Decoder decoder(windowSize);
+
+        for (size_t i = 0; i < 200; i++) {
+            auto chunk = stream.chunks[i % 2];
+            for (size_t flips = 0; flips < 4; flips++) {
+                chunk[rng() % chunk.size()] ^= 1 << (rng() % 8);
+            }
+
+            decoder.reset();
+            if (i % 2 == 1) {
+                decoder.trySkipChunk(stream.chunks[0].data(), stream.chunks[0].size(), stream.chunkOutputSize(0));
+            }
+
+            decoder.tryDecompressChunkInto(chunk.data(), chunk.size(), output.data(), stream.chunkOutputSize(i % 2));
+        }
+
+        decoder.reset();
+        auto result = decoder.tryDecompressChunkInto(stream.chunks[0].data(), stream.chunks[0].size(), output.data(), stream.chunkOutputSize(0));
+        LZXD_ASSERT(result.ok() && result.value() == stream.chunkOutputSize(0));
+        LZXD_ASSERT(std::memcmp(output.data(), stream.output.data(), result.value()) == 0);
+    }();
+
+    [&] {
+        // An invalid block type
+        std::vector<uint8_t> data = {0x00, 0x00, 0x00, 0x00};
+        lzxd::Decoder decoder(windowSize);
+        auto result = decoder.tryValidateChunk(data.data(), data.size());
+        LZXD_ASSERT(result.error() == lzxd::ErrorCode::InvalidBlockHeader);
+    }();
+
+    [&] {
+        // E8 translation fails before decoding anything, so the stream can still be validated
+        lzxd::test::Encoder e8Encoder(windowSize);
+        e8Encoder.e8TranslationSize = 12000000;
+        auto e8 = e8Encoder.encode(e8Encoder.splitTokens(lzxd::test::farMatchTokens(windowSize, 0x10000, 0x10000)));
+        lzxd::Decoder decoder(windowSize);
+
+        for (size_t i = 0; i < e8.chunks.size(); i++) {
+            auto result = decoder.tryDecompressChunkInto(e8.chunks[i].data(), e8.chunks[i].size(), output.data(), e8.chunkOutputSize(i));
+            LZXD_ASSERT(result.error() == lzxd::ErrorCode::E8NotImplemented);
+            LZXD_ASSERT(decoder.validateChunk(e8.chunks[i], e8.chunkOutputSize(i)) == e8.chunkOutputSize(i));
+        }
+    }();
+
+    [&] {
+        // Errors in a batch stay with their own chunk
+        lzxd::Decoder good(windowSize), bad(windowSize);
+        std::vector<uint8_t> badOutput(stream.chunkSize);
+        std::vector<lzxd::InterleavedChunk> batch = {
+            {&good, stream.chunks[0].data(), stream.chunks[0].size(), output.data(), stream.chunkOutputSize(0)},
+            {&bad, stream.chunks[0].data(), 8, badOutput.data(), stream.chunkOutputSize(0)},
+        };
+
+        lzxd::Decoder::decompressInterleaved(batch);
+        LZXD_ASSERT(batch[0].error == lzxd::ErrorCode::Ok && batch[0].decodedLen == stream.chunkOutputSize(0));
+        LZXD_ASSERT(batch[1].error != lzxd::ErrorCode::Ok);
+    }();
+}
+
+void testIndependentChunks() {
+    constexpr size_t windowSize = 0x10000;
+    auto stream = lzxd::test::independentTextChunks(windowSize, 0x8000, 9);
+
+    lzxd::IndependentChunks chunks{stream.data.data(), stream.offsets, stream.output.size(), 0x8000, windowSize};
+
+    for (unsigned threads : {1u, 3u, 0u}) {
+        std::vector<uint8_t> output(stream.output.size());
+        LZXD_ASSERT(lzxd::decompressChunksParallel(chunks, output.data(), threads) == lzxd::ErrorCode::Ok);
+        LZXD_ASSERT(output == stream.output);
+    }
+
+    [&] {
+        // A decoder reused across streams decodes the same as a fresh one
+        lzxd::Decoder decoder(windowSize);
+        std::vector<uint8_t> output(0x8000);
+
+        for (size_t i : {3, 1, 3}) {
+            decoder.reset();
+            size_t len = decoder.decompressChunkInto(stream.data.data() + stream.offsets[i], stream.offsets[i + 1] - stream.offsets[i], output.data());
+            LZXD_ASSERT(len == 0x8000 && std::memcmp(output.data(), stream.output.data() + i * 0x8000, len) == 0);
+        }
+    }();
+
+    [&] {
+        // An empty resource decodes to nothing
+        std::vector<size_t> none{0};
+        LZXD_ASSERT(lzxd::decompressChunksParallel({stream.data.data(), none, 0, 0x8000, windowSize}, nullptr, 4) == lzxd::ErrorCode::Ok);
+
+        // One more offset than chunks is required
+        std::vector<uint8_t> output(stream.output.size());
+        auto bad = chunks;
+        bad.offsets = bad.offsets.first(bad.offsets.size() - 1);
+        LZXD_ASSERT(lzxd::decompressChunksParallel(bad, output.data(), 2) == lzxd::ErrorCode::InvalidChunkTable);
+
+        // A corrupt chunk fails the whole resource
+        auto data = stream.data;
+        std::fill(data.begin() + stream.offsets[4], data.begin() + stream.offsets[5], 0);
+        bad = chunks;
+        bad.data = data.data();
+        LZXD_ASSERT(lzxd::decompressChunksParallel(bad, output.data(), 2) != lzxd::ErrorCode::Ok);
+    }();
+}
+
+void testTreeCache() {
+    constexpr size_t windowSize = 0x10000;
+    auto stream = lzxd::test::independentTextChunks(windowSize, 0x8000, 9);
+
+    [&] {
+        // Every chunk carries the same trees, so they are only built once
+        auto cache = std::make_shared<lzxd::TreeCache>();
+        lzxd::IndependentChunks chunks{stream.data.data(), stream.offsets, stream.output.size(), 0x8000, windowSize, cache};
+
+        for (unsigned threads : {1u, 3u}) {
+            std::vector<uint8_t> output(stream.output.size());
+            LZXD_ASSERT(lzxd::decompressChunksParallel(chunks, output.data(), threads) == lzxd::ErrorCode::Ok);
+            LZXD_ASSERT(output == stream.output);
+        }
+
+        auto stats = cache->stats();
+        LZXD_ASSERT(stats.entries == stats.misses && stats.entries <= 3);
+        LZXD_ASSERT(stats.hits + stats.misses >= 18 && stats.evictions == 0 && stats.bytes > 0);
+    }();
+
+    [&] {
+        // Trees are shared, and only valid lengths are cached
+        lzxd::TreeCache cache;
+        std::vector<uint8_t> lengths{1, 2, 3, 3};
+        auto tree = cache.get(lengths, false);
+        LZXD_ASSERT(tree && cache.get(lengths, false) == tree && cache.get(lengths, true) != tree);
+
+        std::vector<uint8_t> invalid{1, 1, 1};
+        LZXD_ASSERT(!cache.get(invalid, false) && cache.stats().entries == 2);
+
+        // Evicted trees stay valid for their holders
+        lzxd::TreeCache small(1);
+        auto first = small.get(lengths, false);
+        LZXD_ASSERT(small.get(std::vector<uint8_t>{1, 1}, false) && small.stats().evictions == 1);
+        LZXD_ASSERT(first->m_lengths.size() == 4 && small.stats().entries == 1);
+    }();
+
+    [&] {
+        // Turning the cache on and off between chunks, including in the middle of a block
+        lzxd::test::Encoder encoder(windowSize, 0x8000, 0xC000);
+        auto blocks = encoder.encode(encoder.splitTokens(lzxd::test::textTokens(0x30000, "etaoinshrdlucmfw")));
+        auto cache = std::make_shared<lzxd::TreeCache>();
+        lzxd::Decoder decoder(windowSize);
+        std::vector<uint8_t> output;
+
+        for (size_t i = 0; i < blocks.chunks.size(); i++) {
+            decoder.setTreeCache(i % 2 == 0 ? cache : nullptr);
+            auto chunk = decoder.decompressChunk(blocks.chunks[i], blocks.chunkOutputSize(i));
+            output.insert(output.end(), chunk.begin(), chunk.end());
+        }
+
+        LZXD_ASSERT(output == blocks.output);
+    }();
+}
+
+void testDecoderClone() {
+    constexpr size_t windowSize = 0x40000;
+    lzxd::test::Encoder encoder(windowSize);
+    auto tokens = lzxd::test::farMatchTokens(windowSize, 0x20000, 0x40000);
+    auto stream = encoder.encode(encoder.splitTokens(tokens));
+
+    // Decodes chunks `[from, to)` into a copy of the output up to there
+    auto decodeFrom = [&](lzxd::Decoder& decoder, size_t from, size_t to) {
+        std::vector<uint8_t> output;
+        for (size_t i = from; i < to; i++) {
+            auto chunk = decoder.decompressChunk(stream.chunks[i], stream.chunkOutputSize(i));
+            output.insert(output.end(), chunk.begin(), chunk.end());
+        }
+        return output;
+    };
+
+    auto expected = [&](size_t from, size_t to) {
+        return std::vector<uint8_t>(stream.output.begin() + from * stream.chunkSize, stream.output.begin() + std::min(to * stream.chunkSize, stream.output.size()));
+    };
+
+    size_t count = stream.chunks.size();
+    lzxd::Decoder decoder(windowSize);
+    decodeFrom(decoder, 0, 3);
+
+    // Clones continue the stream on their own, the decoder they were cloned from included
+    auto first = decoder.clone();
+    auto second = decoder.clone();
+    LZXD_ASSERT(decodeFrom(decoder, 3, count) == expected(3, count));
+    LZXD_ASSERT(decodeFrom(first, 3, count) == expected(3, count));
+
+    // A clone of a clone that has decoded since
+    decodeFrom(second, 3, 4);
+    auto third = second.clone();
+    LZXD_ASSERT(decodeFrom(second, 4, count) == expected(4, count));
+    LZXD_ASSERT(decodeFrom(third, 4, count) == expected(4, count));
+
+    [&] {
+        // A clone of a clone that has not, and one reset for another stream
+        lzxd::Decoder primed(windowSize);
+        decodeFrom(primed, 0, 2);
+
+        auto a = primed.clone();
+        auto b = a.clone();
+        LZXD_ASSERT(decodeFrom(b, 2, count) == expected(2, count));
+        LZXD_ASSERT(decodeFrom(a, 2, count) == expected(2, count));
+
+        auto c = primed.clone();
+        c.reset();
+        LZXD_ASSERT(decodeFrom(c, 0, count) == stream.output);
+    }();
+}
+
+void testFramedParallel() {
+    constexpr size_t windowSize = 0x20000;
+    const std::string alphabet = "etaoinshrdlucmfw";
+    std::vector<uint8_t> raw(0x5001, 'r');
+
+    // Text, far matches reaching many chunks back and an uncompressed block spanning chunks
+    std::vector<lzxd::test::Token> tokens = lzxd::test::textTokens(0x30000, alphabet);
+    auto far = lzxd::test::farMatchTokens(windowSize, 0x10000, 0x40000, 2);
+    tokens.insert(tokens.end(), far.begin(), far.end());
+    tokens.push_back(lzxd::test::Token::uncompressed(raw.data(), raw.size()));
+    tokens.push_back(lzxd::test::Token::match(0x1234, 200));
+
+    lzxd::test::Encoder encoder(windowSize);
+    auto stream = lzxd::test::framedStream(encoder.encode(encoder.splitTokens(tokens)));
+    lzxd::FramedChunks chunks{stream.data.data(), stream.offsets, stream.output.size(), 0x8000, windowSize};
+
+    for (unsigned threads : {1u, 2u, 5u, 16u, 0u}) {
+        std::vector<uint8_t> output(stream.output.size());
+        LZXD_ASSERT(lzxd::decompressFramedParallel(chunks, output.data(), threads) == lzxd::ErrorCode::Ok);
+        LZXD_ASSERT(output == stream.output);
+    }
+
+    [&] {
+        // A match before the start of the stream fails serially and in parallel
+        lzxd::test::Encoder invalid(windowSize);
+        invalid.checkOffsets = false;
+        auto bad = lzxd::test::framedStream(invalid.encode({lzxd::test::Token::literal('a'), lzxd::test::Token::match(100, 50)}));
+        lzxd::FramedChunks badChunks{bad.data.data(), bad.offsets, bad.output.size(), 0x8000, windowSize};
+
+        std::vector<uint8_t> output(bad.output.size());
+        LZXD_ASSERT(lzxd::decompressFramedParallel(badChunks, output.data(), 1) == lzxd::ErrorCode::MatchOutOfBounds);
+        LZXD_ASSERT(lzxd::decompressFramedParallel(badChunks, output.data(), 3) == lzxd::ErrorCode::MatchOutOfBounds);
+    }();
+
+    [&] {
+        // A corrupt chunk fails like it does serially
+        auto data = stream.data;
+        std::fill(data.begin() + stream.offsets[2], data.begin() + stream.offsets[3], 0);
+        auto bad = chunks;
+        bad.data = data.data();
+
+        std::vector<uint8_t> output(stream.output.size());
+        auto serial = lzxd::decompressFramedParallel(bad, output.data(), 1);
+        LZXD_ASSERT(serial != lzxd::ErrorCode::Ok);
+        LZXD_ASSERT(lzxd::decompressFramedParallel(bad, output.data(), 3) == serial);
+    }();
+}
+
+void testKernels() {
+    constexpr size_t windowSize = 0x80000;
+    const std::string alphabet = "etaoinshrdlucmfw";
+
+    lzxd::test::Encoder textEncoder(windowSize);
+    textEncoder.mainLengths() = lzxd::test::textMainLengths(windowSize, alphabet);
+    auto text = textEncoder.encode(textEncoder.splitTokens(lzxd::test::textTokens(0x60000, alphabet)));
+
+    lzxd::test::Encoder farEncoder(windowSize);
+    auto far = farEncoder.encode(farEncoder.splitTokens(lzxd::test::farMatchTokens(windowSize, 0x40000, 0x40000)));
+
+    LZXD_ASSERT(lzxd::Decoder::kernelSupported(lzxd::DecodeKernel::Scalar));
+
+    for (auto kernel : {lzxd::DecodeKernel::Scalar, lzxd::DecodeKernel::Avx2}) {
+        if (!lzxd::Decoder::kernelSupported(kernel)) {
+            std::cout << "Skipping unsupported decode kernel " << static_cast<int>(kernel) << std::endl;
+            continue;
+        }
+
+        for (auto* stream : {&text, &far}) {
+            lzxd::Decoder decoder(windowSize);
+            LZXD_ASSERT(decoder.setKernel(kernel) && decoder.kernel() == kernel);
+            checkStream(decoder, *stream);
+        }
+    }
+}
+
+void testAlignedBlocks() {
+    constexpr size_t windowSize = 0x40000;
+
+    // Every combination of verbatim or aligned blocks, with or without the repeated offsets
+    std::vector<lzxd::test::EncodedStream> streams;
+    for (bool aligned : {false, true}) {
+        for (bool repeated : {false, true}) {
+            lzxd::test::Encoder encoder(windowSize, 0x8000, 0x6000);
+            encoder.alignedBlocks = aligned;
+            encoder.repeatedOffsets = repeated;
+            streams.push_back(encoder.encode(encoder.splitTokens(lzxd::test::repeatedOffsetTokens(windowSize, 0x48000, 3 + aligned))));
+        }
+    }
+
+    for (auto kernel : {lzxd::DecodeKernel::Scalar, lzxd::DecodeKernel::Avx2}) {
+        if (!lzxd::Decoder::kernelSupported(kernel)) {
+            continue;
+        }
+
+        for (auto& stream : streams) {
+            lzxd::Decoder decoder(windowSize);
+            decoder.setKernel(kernel);
+            checkStream(decoder, stream);
+
+            // The second decoder takes every tree from the cache
+            auto cache = std::make_shared<lzxd::TreeCache>();
+            for (int i = 0; i < 2; i++) {
+                lzxd::Decoder cached(windowSize);
+                cached.setKernel(kernel);
+                cached.setTreeCache(cache);
+                checkStream(cached, stream);
+            }
+            LZXD_ASSERT(cache->stats().hits > 0);
+        }
+    }
+
+    [&] {
+        // Clones taken in the middle of the streams, where the repeated offsets carry over
+        for (auto& stream : streams) {
+            lzxd::Decoder decoder(windowSize);
+            std::vector<uint8_t> output;
+            for (size_t i = 0; i < 4; i++) {
+                auto chunk = decoder.decompressChunk(stream.chunks[i], stream.chunkOutputSize(i));
+                output.insert(output.end(), chunk.begin(), chunk.end());
+            }
+
+            auto clone = decoder.clone();
+            for (size_t i = 4; i < stream.chunks.size(); i++) {
+                auto chunk = clone.decompressChunk(stream.chunks[i], stream.chunkOutputSize(i));
+                output.insert(output.end(), chunk.begin(), chunk.end());
+            }
+            LZXD_ASSERT(output == stream.output);
+        }
+    }();
+
+    [&] {
+        // All four streams at once
+        std::vector<lzxd::Decoder> decoders;
+        std::vector<std::vector<uint8_t>> outputs;
+        for (auto& stream : streams) {
+            decoders.emplace_back(windowSize);
+            outputs.emplace_back(stream.output.size());
+        }
+
+        for (size_t chunk = 0; chunk < streams[0].chunks.size(); chunk++) {
+            std::vector<lzxd::InterleavedChunk> batch;
+            for (size_t i = 0; i < streams.size(); i++) {
+                auto& data = streams[i].chunks[chunk];
+                batch.push_back({&decoders[i], data.data(), data.size(), outputs[i].data() + chunk * streams[i].chunkSize, streams[i].chunkOutputSize(chunk)});
+            }
+
+            lzxd::Decoder::decompressInterleaved(batch);
+            for (auto& entry : batch) {
+                LZXD_ASSERT(entry.error == lzxd::ErrorCode::Ok && entry.decodedLen == entry.outputSize);
+            }
+        }
+
+        for (size_t i = 0; i < streams.size(); i++) {
+            LZXD_ASSERT(outputs[i] == streams[i].output);
+        }
+    }();
+
+    [&] {
+        // The framed pipeline records the same tokens
+        auto framed = lzxd::test::framedStream(streams.back());
+        lzxd::FramedChunks chunks{framed.data.data(), framed.offsets, framed.output.size(), 0x8000, windowSize};
+
+        std::vector<uint8_t> output(framed.output.size());
+        LZXD_ASSERT(lzxd::decompressFramedParallel(chunks, output.data(), 2) == lzxd::ErrorCode::Ok);
+        LZXD_ASSERT(output == framed.output);
+    }();
+}
+
+void testProfiling() {
+#if defined(LZXD_ENABLE_PROFILING)
+    constexpr size_t windowSize = 0x80000;
+    lzxd::test::Encoder encoder(windowSize, 32768, 0x6000);
+    auto stream = encoder.encode(encoder.splitTokens(lzxd::test::farMatchTokens(windowSize, 0x20000, 0x20000)));
+
+    lzxd::Decoder decoder(windowSize);
+    checkStream(decoder, stream);
+
+    auto& profile = decoder.profile();
+    LZXD_ASSERT(profile.chunks == stream.chunks.size());
+
+    uint64_t histogramTotal = 0;
+    for (auto count : profile.latencyHistogram) {
+        histogramTotal += count;
+    }
+    LZXD_ASSERT(histogramTotal == profile.chunks);
+
+    for (auto phase : {lzxd::Phase::Trees, lzxd::Phase::Tokens, lzxd::Phase::Matches, lzxd::Phase::Output}) {
+        LZXD_ASSERT(profile.cycles[static_cast<size_t>(phase)] != 0);
+    }
+
+    // Blocks of 0x6000 bytes, so the last 32 KiB chunk holds parts of two of them
+    auto& chunk = profile.lastChunk;
+    LZXD_ASSERT(chunk.index == stream.chunks.size() - 1 && chunk.blocks.size() == 2);
+
+    uint64_t blockCycles = 0;
+    for (auto& block : chunk.blocks) {
+        for (auto cycles : block.cycles) {
+            blockCycles += cycles;
+        }
+    }
+    LZXD_ASSERT(blockCycles <= chunk.totalCycles);
+
+    decoder.resetProfile();
+    LZXD_ASSERT(decoder.profile().chunks == 0);
+#endif
+}
+
+void testNoAllocations() {
+    constexpr size_t windowSize = 0x100000;
+    const std::string alphabet = "etaoinshrdlucmfw";
+
+    // Verbatim and uncompressed blocks, some spanning chunks
+    lzxd::test::Encoder textEncoder(windowSize, 32768, 0x5000);
+    textEncoder.mainLengths() = lzxd::test::textMainLengths(windowSize, alphabet);
+    auto text = textEncoder.encode(textEncoder.splitTokens(lzxd::test::textTokens(0x30000, alphabet)));
+
+    std::vector<uint8_t> raw(0x9000, 'x');
+    std::vector<lzxd::test::Token> tokens = lzxd::test::farMatchTokens(windowSize, 0x10000, 0x10000);
+    tokens.push_back(lzxd::test::Token::uncompressed(raw.data(), raw.size()));
+    lzxd::test::Encoder mixedEncoder(windowSize);
+    auto mixed = mixedEncoder.encode(mixedEncoder.splitTokens(tokens));
+
+    std::vector<uint8_t> output(32768);
+    lzxd::Decoder decoder(windowSize);
+
+    for (auto* stream : {&text, &mixed}) {
+        decoder.reset();
+        size_t before = g_allocations.load();
+
+        for (size_t i = 0; i < stream->chunks.size(); i++) {
+            auto& chunk = stream->chunks[i];
+            auto result = decoder.tryDecompressChunkInto(chunk.data(), chunk.size(), output.data(), stream->chunkOutputSize(i));
+            LZXD_ASSERT(result.ok() && std::memcmp(output.data(), stream->output.data() + i * stream->chunkSize, result.value()) == 0);
+        }
+
+        LZXD_ASSERT(g_allocations.load() == before);
+    }
+}
+
+void testDiskCache() {
+    auto directory = std::filesystem::temp_directory_path() / ("lzxd-cache-test-" + std::to_string(std::random_device{}()));
+    std::filesystem::remove_all(directory);
+
+    constexpr size_t windowSize = 0x10000;
+    lzxd::test::Encoder encoder(windowSize);
+    auto stream = encoder.encode(encoder.splitTokens(lzxd::test::farMatchTokens(windowSize, 0x8000, 0x8000)));
+    auto& chunk = stream.chunks[0];
+
+    size_t decodes = 0;
+    auto decode = [&]() -> lzxd::Result<std::vector<uint8_t>> {
+        decodes++;
+        lzxd::Decoder decoder(windowSize);
+        std::vector<uint8_t> output(stream.chunkOutputSize(0));
+        auto result = decoder.tryDecompressChunkInto(chunk.data(), chunk.size(), output.data(), output.size());
+        if (!result) {
+            return result.error();
+        }
+        return output;
+    };
+
+    [&] {
+        // Keys depend on the input and the parameters
+        auto key = lzxd::DiskCache::key(chunk.data(), chunk.size(), windowSize, 32768, 32768);
+        LZXD_ASSERT(key == lzxd::DiskCache::key(chunk.data(), chunk.size(), windowSize, 32768, 32768));
+        LZXD_ASSERT(key != lzxd::DiskCache::key(chunk.data(), chunk.size() - 1, windowSize, 32768, 32768));
+        LZXD_ASSERT(key != lzxd::DiskCache::key(chunk.data(), chunk.size(), windowSize * 2, 32768, 32768));
+        LZXD_ASSERT(key != lzxd::DiskCache::key(chunk.data(), chunk.size(), windowSize, 32767, 32768));
+        LZXD_ASSERT(key != lzxd::DiskCache::key(chunk.data(), chunk.size(), windowSize, 32768, 0x10000));
+    }();
+
+    [&] {
+        // A miss decodes and stores, a hit maps the stored entry
+        lzxd::DiskCache cache(directory);
+        auto key = lzxd::DiskCache::key(chunk.data(), chunk.size(), windowSize, 32768, 32768);
+        LZXD_ASSERT(!cache.find(key));
+
+        auto first = cache.getOrDecode(key, decode);
+        auto second = cache.getOrDecode(key, decode);
+        LZXD_ASSERT(first.ok() && second.ok() && decodes == 1);
+        LZXD_ASSERT(second.value().size() == 32768);
+        LZXD_ASSERT(std::memcmp(second.value().data(), stream.output.data(), 32768) == 0);
+#ifdef __linux__
+        LZXD_ASSERT(second.value().mapped());
+#endif
+
+        // A damaged entry is a miss, as is one of another version
+        auto path = std::filesystem::directory_iterator(directory)->path();
+        auto corrupt = [&](size_t offset) {
+            std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(offset);
+            file.put('!');
+        };
+
+        corrupt(32 + 100);
+        LZXD_ASSERT(!cache.find(key));
+
+        LZXD_ASSERT(cache.store(key, stream.output.data(), 32768) && cache.find(key));
+        corrupt(8);
+        LZXD_ASSERT(!cache.find(key));
+
+        LZXD_ASSERT(cache.store(key, stream.output.data(), 32768) && cache.find(key));
+        std::filesystem::resize_file(path, 1000);
+        LZXD_ASSERT(!cache.find(key));
+
+        // Decoding errors are returned and not stored
+        auto failed = cache.getOrDecode(key + 1, []() -> lzxd::Result<std::vector<uint8_t>> { return lzxd::ErrorCode::InvalidBlockHeader; });
+        LZXD_ASSERT(failed.error() == lzxd::ErrorCode::InvalidBlockHeader);
+        LZXD_ASSERT(!cache.find(key + 1));
+    }();
+
+    [&] {
+        // Room for three entries, the least recently used one is evicted
+        std::filesystem::remove_all(directory);
+        lzxd::DiskCache cache(directory, 3 * (1000 + 32));
+        std::vector<uint8_t> data(1000, 'x');
+        auto now = std::filesystem::file_time_type::clock::now();
+
+        for (uint64_t key = 0; key < 3; key++) {
+            LZXD_ASSERT(cache.store(key, data.data(), data.size()));
+        }
+
+        // Entries are named by their key, older keys were used longer ago
+        for (auto& entry : std::filesystem::directory_iterator(directory)) {
+            auto key = std::stoull(entry.path().stem().string(), nullptr, 16);
+            std::filesystem::last_write_time(entry.path(), now - std::chrono::minutes(10 - key));
+        }
+
+        LZXD_ASSERT(cache.find(0));
+        LZXD_ASSERT(cache.store(3, data.data(), data.size()));
+
+        LZXD_ASSERT(cache.find(0) && !cache.find(1) && cache.find(2) && cache.find(3));
+        LZXD_ASSERT(cache.totalSize() <= 3 * (1000 + 32));
+    }();
+
+    std::filesystem::remove_all(directory);
+}
+
 void decodeBlock(std::filesystem::path path) {
     constexpr size_t windowSize = 0x80000;
 
@@ -132,7 +1237,7 @@ void decodeBlock(std::filesystem::path path) {
     outfile.close();
 }
 
-void decodeDatabase(std::filesystem::path path) {
+void decodeDatabase(std::filesystem::path path, const char* cacheDir = nullptr) {
     // Decode a .gmsodf database
 
     // Read the file
@@ -150,39 +1255,74 @@ void decodeDatabase(std::filesystem::path path) {
         return;
     }
 
-    uint16_t flags = BSWAP16(*reinterpret_cast<uint16_t*>(data.data() + 2)); // no idea what this really is, usually 00 01
+    [[maybe_unused]] uint16_t flags = BSWAP16(*reinterpret_cast<uint16_t*>(data.data() + 2)); // no idea what this really is, usually 00 01
     uint16_t headerSize = BSWAP16(*reinterpret_cast<uint16_t*>(data.data() + 4));
-    uint32_t remainingUncBytes = BSWAP32(*reinterpret_cast<uint32_t*>(data.data() + 6));
+    uint32_t outputSize = BSWAP32(*reinterpret_cast<uint32_t*>(data.data() + 6));
 
-    size_t dataBeginOffset = headerSize;
-
-    size_t currentPos = dataBeginOffset;
     constexpr size_t windowSize = 0x80000;
 
-    lzxd::Decoder decoder(windowSize);
+    // Can run more than once or not at all, so it only reads the captured state
+    auto decode = [&]() -> lzxd::Result<std::vector<uint8_t>> {
+        size_t currentPos = headerSize;
+        size_t written = 0;
 
-    std::vector<uint8_t> output;
+        lzxd::Decoder decoder(windowSize);
+        std::vector<uint8_t> output(outputSize);
 
-    while (currentPos < data.size()) {
-        // read the next chunk
-        // uncompressed size is always equal to 32768, except for the last chunk.
-        // compressed size is available as a 16-bit value at the beginning of the chunk
-        uint16_t compressedSize = BSWAP16(*reinterpret_cast<uint16_t*>(data.data() + currentPos));
-        currentPos += 2;
+        while (currentPos < data.size() && written < output.size()) {
+            // read the next chunk
+            // uncompressed size is always equal to 32768, except for the last chunk.
+            // compressed size is available as a 16-bit value at the beginning of the chunk
+            if (data.size() - currentPos < 2) {
+                return lzxd::ErrorCode::UnexpectedEof;
+            }
 
-        std::cout << "Chunk of size " << compressedSize << std::endl;
+            uint16_t compressedSize = BSWAP16(*reinterpret_cast<uint16_t*>(data.data() + currentPos));
+            currentPos += 2;
 
-        // if we are on the last chunk, the decompressed size of this chunk is `remainingUncBytes`
-        size_t decSize = 32768;
-        if (remainingUncBytes < decSize) {
-            decSize = remainingUncBytes;
+            if (data.size() - currentPos < compressedSize) {
+                return lzxd::ErrorCode::UnexpectedEof;
+            }
+
+            std::cout << "Chunk of size " << compressedSize << std::endl;
+
+            // the last chunk holds whatever is left
+            size_t decSize = std::min<size_t>(32768, output.size() - written);
+
+            auto result = decoder.tryDecompressChunkInto(data.data() + currentPos, compressedSize, output.data() + written, decSize);
+            if (!result) {
+                return result.error();
+            }
+
+            currentPos += compressedSize;
+            written += result.value();
+        }
+
+        if (written != output.size()) {
+            return lzxd::ErrorCode::UnexpectedEof;
         }
 
-        auto dechunk = decoder.decompressChunk(data.data() + currentPos, compressedSize, decSize);
-        output.insert(output.end(), dechunk.begin(), dechunk.end());
+        return output;
+    };
+
+    // With a cache directory, a database decoded before is mapped instead
+    lzxd::CachedBuffer output;
+    lzxd::ErrorCode error = lzxd::ErrorCode::Ok;
 
-        currentPos += compressedSize;
-        remainingUncBytes -= decSize;
+    if (cacheDir) {
+        lzxd::DiskCache cache(cacheDir);
+        auto result = cache.getOrDecode(lzxd::DiskCache::key(data.data(), data.size(), windowSize, outputSize, 32768), decode);
+        error = result.error();
+        output = std::move(result.value());
+    } else {
+        auto result = decode();
+        error = result.error();
+        output = lzxd::CachedBuffer(std::move(result.value()));
+    }
+
+    if (error != lzxd::ErrorCode::Ok) {
+        std::cerr << "Failed to decode " << path << ": " << lzxd::errorMessage(error) << std::endl;
+        return;
     }
 
     // write to file
@@ -202,13 +1342,32 @@ int main(int argc, const char** argv) {
             return 0;
         } else if (operation == "decode-database") {
             std::filesystem::path path = argv[2];
-            decodeDatabase(path);
+            decodeDatabase(path, argc > 3 ? argv[3] : nullptr);
             return 0;
         }
     }
 
     testBitBuffer();
     testDecoder();
+    testAllocator();
+    testMultiLiterals();
+    testLongCodes();
+    testInterleaved();
+    testUncompressedBlocks();
+    testChunkSizes();
+    testChunkViews();
+    testScatterOutput();
+    testValidateAndSkip();
+    testCorruptInput();
+    testIndependentChunks();
+    testFramedParallel();
+    testTreeCache();
+    testDecoderClone();
+    testKernels();
+    testAlignedBlocks();
+    testProfiling();
+    testNoAllocations();
+    testDiskCache();
 
     return 0;
 }
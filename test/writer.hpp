@@ -0,0 +1,562 @@
+#pragma once
+
+// A minimal LZX writer used to produce synthetic streams for tests and benchmarks.
+// It emits verbatim or aligned offset blocks with fixed trees, uncompressed blocks, and can
+// encode matches against the repeated offsets.
+
+#include <lzxd/lzxd.hpp>
+#include <lzxd/error.hpp>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace lzxd::test {
+
+constexpr auto BASE_POSITION = [] {
+    std::array<uint32_t, 291> out{};
+    uint32_t base = 0;
+    for (size_t i = 0; i < out.size(); i++) {
+        out[i] = base;
+
+        uint8_t footer = i < 4 ? 0 : (i < 36 ? (i - 2) / 2 : 17);
+        base += 1u << footer;
+    }
+    return out;
+}();
+
+constexpr uint8_t footerBits(size_t slot) {
+    return slot < 4 ? 0 : (slot < 36 ? (slot - 2) / 2 : 17);
+}
+
+// Writes 16-bit little-endian words, filling each word from the most significant bit.
+class BitWriter {
+public:
+    void write(uint32_t value, uint8_t count) {
+        for (int i = count - 1; i >= 0; i--) {
+            m_acc = (m_acc << 1) | ((value >> i) & 1);
+            if (++m_bits == 16) {
+                this->flushWord();
+            }
+        }
+    }
+
+    // Pads the current word with zeros
+    void pad() {
+        if (m_bits != 0) {
+            this->write(0, 16 - m_bits);
+        }
+    }
+
+    // Mirrors `BitStream::align`, which skips an entire word if already aligned
+    void align() {
+        this->write(0, m_bits == 0 ? 16 : 16 - m_bits);
+    }
+
+    void writeRaw(const uint8_t* data, size_t size) {
+        LZXD_ASSERT(m_bits == 0);
+        m_out.insert(m_out.end(), data, data + size);
+    }
+
+    size_t bitsPending() const {
+        return m_bits;
+    }
+
+    std::vector<uint8_t> take() {
+        this->pad();
+        return std::move(m_out);
+    }
+
+private:
+    std::vector<uint8_t> m_out;
+    uint32_t m_acc = 0;
+    uint8_t m_bits = 0;
+
+    void flushWord() {
+        m_out.push_back(m_acc & 0xff);
+        m_out.push_back((m_acc >> 8) & 0xff);
+        m_acc = 0;
+        m_bits = 0;
+    }
+};
+
+struct Code {
+    uint16_t bits;
+    uint8_t length;
+};
+
+inline std::vector<Code> canonicalCodes(const std::vector<uint8_t>& lengths) {
+    std::vector<Code> codes(lengths.size());
+    uint32_t code = 0;
+
+    for (uint8_t len = 1; len <= 16; len++) {
+        for (size_t sym = 0; sym < lengths.size(); sym++) {
+            if (lengths[sym] == len) {
+                codes[sym] = Code{static_cast<uint16_t>(code), len};
+                code++;
+            }
+        }
+        code <<= 1;
+    }
+
+    return codes;
+}
+
+// Assigns lengths to `count` symbols so that the tree is complete, giving the first
+// symbols the shorter codes.
+inline std::vector<uint8_t> completeLengths(size_t count) {
+    uint8_t k = 0;
+    while ((size_t(1) << k) < count) {
+        k++;
+    }
+
+    size_t shorter = (size_t(1) << k) - count;
+    std::vector<uint8_t> lengths(count, k);
+    for (size_t i = 0; i < shorter; i++) {
+        lengths[i] = k - 1;
+    }
+
+    return lengths;
+}
+
+// A literal (`length == 0`), a match, or an uncompressed block (`raw != nullptr`)
+struct Token {
+    uint8_t value;
+    uint32_t offset;
+    uint32_t length;
+    const uint8_t* raw = nullptr; // must outlive the encoder
+
+    static Token literal(uint8_t value) { return {value, 0, 0}; }
+    static Token match(uint32_t offset, uint32_t length) { return {0, offset, length}; }
+    static Token uncompressed(const uint8_t* data, uint32_t length) { return {0, 0, length, data}; }
+
+    size_t size() const { return length == 0 ? 1 : length; }
+};
+
+struct EncodedStream {
+    std::vector<std::vector<uint8_t>> chunks;
+    std::vector<uint8_t> output;
+    size_t chunkSize;
+
+    size_t chunkOutputSize(size_t idx) const {
+        return std::min(chunkSize, output.size() - idx * chunkSize);
+    }
+};
+
+class Encoder {
+public:
+    // Trees default to complete trees over every symbol
+    Encoder(size_t windowSize, size_t chunkSize = 32768, size_t blockSize = 0x10000)
+        : m_windowSize(windowSize), m_chunkSize(chunkSize), m_blockSize(blockSize) {
+        m_mainLengths = completeLengths(256 + 8 * lzxd::detail::positionSlotsFor(windowSize));
+        m_lengthLengths = completeLengths(249);
+        m_alignedLengths = {2, 2, 3, 3, 3, 4, 5, 5};
+    }
+
+    // Allows matches reaching before the start of the stream, to produce invalid streams
+    bool checkOffsets = true;
+    // Enables E8 translation with this size, which the decoder does not implement
+    uint32_t e8TranslationSize = 0;
+    // Writes aligned offset blocks instead of verbatim ones
+    bool alignedBlocks = false;
+    // Encodes matches whose offset is one of R0, R1 or R2 with position slots 0 to 2
+    bool repeatedOffsets = false;
+
+    std::vector<uint8_t>& mainLengths() { return m_mainLengths; }
+    std::vector<uint8_t>& lengthLengths() { return m_lengthLengths; }
+    std::vector<uint8_t>& alignedLengths() { return m_alignedLengths; }
+
+    // Matches must not cross chunk boundaries, use `splitTokens` to ensure this.
+    // Uncompressed tokens are written as their own block and may span several chunks.
+    EncodedStream encode(const std::vector<Token>& tokens) {
+        auto mainCodes = canonicalCodes(m_mainLengths);
+        auto lengthCodes = canonicalCodes(m_lengthLengths);
+        auto alignedCodes = canonicalCodes(m_alignedLengths);
+        uint32_t r0 = 1, r1 = 1, r2 = 1;
+        std::vector<uint8_t> prevMain(m_mainLengths.size()), prevLength(m_lengthLengths.size());
+
+        size_t total = 0;
+        for (auto& tok : tokens) {
+            total += tok.size();
+        }
+
+        EncodedStream out;
+        out.chunkSize = m_chunkSize;
+        out.output.reserve(total);
+
+        BitWriter writer;
+        writer.write(e8TranslationSize != 0, 1);
+        if (e8TranslationSize != 0) {
+            writer.write(e8TranslationSize >> 16, 16);
+            writer.write(e8TranslationSize & 0xFFFF, 16);
+        }
+
+        size_t blockRemaining = 0, chunkRemaining = std::min(m_chunkSize, total);
+        bool padPending = false;
+
+        auto nextChunk = [&] {
+            out.chunks.push_back(writer.take());
+            writer = BitWriter{};
+            chunkRemaining = std::min(m_chunkSize, total - out.output.size());
+        };
+
+        for (size_t t = 0; t < tokens.size(); t++) {
+            const auto& tok = tokens[t];
+
+            if (padPending) {
+                // The decoder skips the padding of an odd-sized uncompressed block when reading the next header
+                uint8_t zero = 0;
+                writer.writeRaw(&zero, 1);
+                padPending = false;
+            }
+
+            if (tok.raw) {
+                LZXD_ASSERT(blockRemaining == 0);
+
+                writer.write(0b011, 3);
+                writer.write(tok.length, 24);
+                writer.align();
+                for (int i = 0; i < 3; i++) {
+                    // R0, R1, R2 as 32-bit little-endian integers
+                    writer.write(1, 16);
+                    writer.write(0, 16);
+                }
+                r0 = r1 = r2 = 1;
+
+                size_t written = 0;
+                while (written < tok.length) {
+                    size_t part = std::min<size_t>(tok.length - written, chunkRemaining);
+                    writer.writeRaw(tok.raw + written, part);
+                    out.output.insert(out.output.end(), tok.raw + written, tok.raw + written + part);
+
+                    written += part;
+                    chunkRemaining -= part;
+                    if (chunkRemaining == 0) {
+                        nextChunk();
+                    }
+                }
+
+                padPending = tok.length % 2 != 0;
+                continue;
+            }
+
+            if (blockRemaining == 0) {
+                // Blocks end on token boundaries
+                for (size_t next = t; next < tokens.size() && !tokens[next].raw && (blockRemaining == 0 || blockRemaining + tokens[next].size() <= m_blockSize); next++) {
+                    blockRemaining += tokens[next].size();
+                }
+
+                writer.write(alignedBlocks ? 0b010 : 0b001, 3);
+                writer.write(static_cast<uint32_t>(blockRemaining), 24);
+
+                if (alignedBlocks) {
+                    for (uint8_t len : m_alignedLengths) {
+                        writer.write(len, 3);
+                    }
+                }
+
+                writeTree(writer, prevMain, m_mainLengths, 0, 256);
+                writeTree(writer, prevMain, m_mainLengths, 256, m_mainLengths.size());
+                writeTree(writer, prevLength, m_lengthLengths, 0, m_lengthLengths.size());
+            }
+
+            LZXD_ASSERT(tok.size() <= chunkRemaining && tok.size() <= blockRemaining);
+
+            if (tok.length == 0) {
+                writeCode(writer, mainCodes[tok.value]);
+                out.output.push_back(tok.value);
+            } else {
+                LZXD_ASSERT(tok.offset >= 1 && tok.length >= 2 && tok.length <= 257);
+                LZXD_ASSERT(tok.offset <= out.output.size() || !checkOffsets);
+
+                uint32_t formatted = tok.offset + 2;
+                size_t slot = 3;
+
+                if (repeatedOffsets && tok.offset == r0) {
+                    slot = 0;
+                } else if (repeatedOffsets && tok.offset == r1) {
+                    slot = 1;
+                    std::swap(r0, r1);
+                } else if (repeatedOffsets && tok.offset == r2) {
+                    slot = 2;
+                    std::swap(r0, r2);
+                } else {
+                    while (BASE_POSITION[slot + 1] <= formatted) {
+                        slot++;
+                    }
+
+                    r2 = r1;
+                    r1 = r0;
+                    r0 = tok.offset;
+                }
+
+                uint32_t header = std::min<uint32_t>(tok.length - 2, 7);
+                writeCode(writer, mainCodes[256 + slot * 8 + header]);
+
+                if (header == 7) {
+                    writeCode(writer, lengthCodes[tok.length - 9]);
+                }
+
+                if (slot >= 3) {
+                    uint32_t footer = formatted - BASE_POSITION[slot];
+                    uint8_t bits = footerBits(slot);
+
+                    if (alignedBlocks && bits >= 3) {
+                        // The low 3 bits go through the aligned offset tree
+                        writer.write(footer >> 3, bits - 3);
+                        writeCode(writer, alignedCodes[footer & 7]);
+                    } else {
+                        writer.write(footer, bits);
+                    }
+                }
+
+                for (size_t i = 0; i < tok.length; i++) {
+                    out.output.push_back(tok.offset <= out.output.size() ? out.output[out.output.size() - tok.offset] : 0);
+                }
+            }
+
+            blockRemaining -= tok.size();
+            chunkRemaining -= tok.size();
+
+            if (chunkRemaining == 0) {
+                nextChunk();
+            }
+        }
+
+        return out;
+    }
+
+    // Splits matches so that none of them crosses a chunk boundary, without changing the output
+    std::vector<Token> splitTokens(const std::vector<Token>& tokens) const {
+        std::vector<Token> out;
+        std::vector<uint8_t> output;
+
+        auto emit = [&](Token tok) {
+            if (tok.raw) {
+                output.insert(output.end(), tok.raw, tok.raw + tok.length);
+                out.push_back(tok);
+                return;
+            }
+
+            if (tok.length == 1) {
+                tok = Token::literal(output[output.size() - tok.offset]);
+            }
+
+            if (tok.length == 0) {
+                output.push_back(tok.value);
+            } else {
+                for (size_t i = 0; i < tok.length; i++) {
+                    output.push_back(output[output.size() - tok.offset]);
+                }
+            }
+
+            out.push_back(tok);
+        };
+
+        for (auto tok : tokens) {
+            size_t left = m_chunkSize - output.size() % m_chunkSize;
+            if (!tok.raw && tok.length != 0 && tok.length > left) {
+                emit(Token::match(tok.offset, static_cast<uint32_t>(left)));
+                emit(Token::match(tok.offset, static_cast<uint32_t>(tok.length - left)));
+            } else {
+                emit(tok);
+            }
+        }
+
+        return out;
+    }
+
+private:
+    size_t m_windowSize, m_chunkSize, m_blockSize;
+    std::vector<uint8_t> m_mainLengths, m_lengthLengths, m_alignedLengths;
+
+    static void writeCode(BitWriter& writer, Code code) {
+        LZXD_ASSERT(code.length != 0);
+        writer.write(code.bits, code.length);
+    }
+
+    static void writeTree(BitWriter& writer, std::vector<uint8_t>& prev, const std::vector<uint8_t>& lengths, size_t start, size_t end) {
+        // Pretree with 12 codes of length 4 and 8 codes of length 5
+        std::vector<uint8_t> pretreeLengths(20);
+        for (size_t i = 0; i < 20; i++) {
+            pretreeLengths[i] = i < 12 ? 4 : 5;
+            writer.write(pretreeLengths[i], 4);
+        }
+
+        auto pretreeCodes = canonicalCodes(pretreeLengths);
+        for (size_t i = start; i < end; i++) {
+            uint8_t delta = (17 + prev[i] - lengths[i]) % 17;
+            writeCode(writer, pretreeCodes[delta]);
+            prev[i] = lengths[i];
+        }
+    }
+};
+
+// Main tree lengths favouring a small alphabet of literals, like text. The alphabet size must be a power of two,
+// and matches are limited to the first 32 position slots (offsets below 65534).
+inline std::vector<uint8_t> textMainLengths(size_t windowSize, const std::string& alphabet) {
+    std::vector<uint8_t> lengths(256 + 8 * lzxd::detail::positionSlotsFor(windowSize));
+    LZXD_ASSERT(std::has_single_bit(alphabet.size()) && lengths.size() >= 512);
+
+    for (char c : alphabet) {
+        lengths[static_cast<uint8_t>(c)] = static_cast<uint8_t>(std::countr_zero(alphabet.size()) + 1);
+    }
+
+    for (size_t i = 256; i < 512; i++) {
+        lengths[i] = 9;
+    }
+
+    return lengths;
+}
+
+// Mostly literals drawn from `alphabet`, with an occasional short match
+inline std::vector<Token> textTokens(size_t size, const std::string& alphabet, uint32_t seed = 1) {
+    std::mt19937 rng(seed);
+    std::vector<Token> tokens;
+
+    size_t pos = 0;
+    while (pos < size) {
+        if (pos > 64 && rng() % 16 == 0 && size - pos >= 20) {
+            auto len = 3 + rng() % 18;
+            tokens.push_back(Token::match(1 + rng() % std::min<size_t>(pos, 65000), len));
+            pos += len;
+        } else {
+            tokens.push_back(Token::literal(alphabet[rng() % alphabet.size()]));
+            pos++;
+        }
+    }
+
+    return tokens;
+}
+
+// Literals followed by matches with offsets drawn from the whole window, for cache and TLB heavy workloads
+inline std::vector<Token> farMatchTokens(size_t windowSize, size_t primeSize, size_t tailSize, uint32_t seed = 1) {
+    std::mt19937 rng(seed);
+    std::vector<Token> tokens;
+
+    for (size_t i = 0; i < 256; i++) {
+        tokens.push_back(Token::literal(static_cast<uint8_t>(rng())));
+    }
+
+    size_t pos = 256;
+    while (pos < primeSize) {
+        auto len = static_cast<uint32_t>(std::min<size_t>(257, primeSize - pos));
+        if (len < 2) {
+            tokens.push_back(Token::literal(0));
+            pos++;
+            continue;
+        }
+
+        tokens.push_back(Token::match(1 + rng() % std::min(pos, windowSize - 3), len));
+        pos += len;
+    }
+
+    size_t end = pos + tailSize;
+    while (pos < end) {
+        if (rng() % 4 == 0) {
+            tokens.push_back(Token::literal(static_cast<uint8_t>(rng())));
+            pos++;
+        } else {
+            auto len = static_cast<uint32_t>(std::min<size_t>(2 + rng() % 30, end - pos));
+            if (len < 2) {
+                tokens.push_back(Token::literal(0));
+                pos++;
+                continue;
+            }
+            tokens.push_back(Token::match(1 + rng() % std::min(pos, windowSize - 3), len));
+            pos += len;
+        }
+    }
+
+    return tokens;
+}
+
+// Literals and matches that mostly reuse one of the last few offsets, with far offsets mixed in so that
+// aligned blocks take both the verbatim and the aligned footer paths
+inline std::vector<Token> repeatedOffsetTokens(size_t windowSize, size_t size, uint32_t seed = 1) {
+    std::mt19937 rng(seed);
+    std::vector<Token> tokens;
+    std::array<uint32_t, 3> recent{1, 1, 1};
+
+    size_t pos = 0;
+    while (pos < size) {
+        if (pos < 16 || rng() % 4 == 0 || size - pos < 2) {
+            tokens.push_back(Token::literal(static_cast<uint8_t>(rng())));
+            pos++;
+            continue;
+        }
+
+        auto len = static_cast<uint32_t>(std::min<size_t>(2 + rng() % (rng() % 8 == 0 ? 256 : 12), size - pos));
+        uint32_t limit = static_cast<uint32_t>(std::min(pos, windowSize - 3));
+        uint32_t offset;
+
+        switch (rng() % 6) {
+            case 0: case 1: case 2: offset = recent[rng() % 3]; break;
+            case 3: offset = 1 + rng() % std::min<uint32_t>(limit, 16); break;
+            default: offset = 1 + rng() % limit; break;
+        }
+
+        offset = std::min(offset, limit);
+        recent[rng() % 3] = offset;
+        tokens.push_back(Token::match(offset, len));
+        pos += len;
+    }
+
+    return tokens;
+}
+
+// Chunks compressed independently of each other and concatenated, as in WIM resources
+// The chunks of an encoded stream stored back to back, like in a framed container such as `.gmsodf`
+struct FramedStream {
+    std::vector<uint8_t> data;
+    std::vector<size_t> offsets;
+    std::vector<uint8_t> output;
+};
+
+inline FramedStream framedStream(const EncodedStream& stream) {
+    FramedStream out;
+    out.offsets.push_back(0);
+
+    for (auto& chunk : stream.chunks) {
+        out.data.insert(out.data.end(), chunk.begin(), chunk.end());
+        out.offsets.push_back(out.data.size());
+    }
+
+    out.output = stream.output;
+    return out;
+}
+
+struct IndependentStream {
+    std::vector<uint8_t> data;
+    std::vector<size_t> offsets;
+    std::vector<uint8_t> output;
+};
+
+// `count` chunks of text, the last one only half full
+inline IndependentStream independentTextChunks(size_t windowSize, size_t chunkSize, size_t count, uint32_t seed = 1) {
+    const std::string alphabet = "etaoinshrdlucmfw";
+    IndependentStream out;
+    out.offsets.push_back(0);
+
+    for (size_t i = 0; i < count; i++) {
+        Encoder encoder(windowSize, chunkSize);
+        encoder.mainLengths() = textMainLengths(windowSize, alphabet);
+
+        size_t size = i + 1 == count ? chunkSize / 2 : chunkSize;
+        auto stream = encoder.encode(encoder.splitTokens(textTokens(size, alphabet, seed + static_cast<uint32_t>(i))));
+
+        for (auto& chunk : stream.chunks) {
+            out.data.insert(out.data.end(), chunk.begin(), chunk.end());
+        }
+
+        out.offsets.push_back(out.data.size());
+        out.output.insert(out.output.end(), stream.output.begin(), stream.output.end());
+    }
+
+    return out;
+}
+
+} // namespace lzxd::test